@@ -0,0 +1,232 @@
+/*********************************************************************
+ * Cartesian path planning pipeline: slerp interpolation through trac-ik,
+ * per-link refinement of the swept distance and collision validation.
+ * Can be embedded in-process or linked by benchmarks.
+ *********************************************************************/
+
+#ifndef KINEMATICS_TEST_CARTESIAN_PATH_PLANNER_H
+#define KINEMATICS_TEST_CARTESIAN_PATH_PLANNER_H
+
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+#include <Eigen/Geometry>
+#include <geometry_msgs/Pose.h>
+#include <ros/node_handle.h>
+#include <moveit/robot_model/robot_model.h>
+#include <moveit/robot_state/robot_state.h>
+#include <moveit/robot_trajectory/robot_trajectory.h>
+#include <moveit/planning_scene/planning_scene.h>
+#include <kinematics_test/ik_seed_predictor.h>
+#include <kinematics_test/link_transform_table.h>
+#include <kinematics_test/memory_accounting.h>
+#include <kinematics_test/refinement_report.h>
+#include <kinematics_test/request_seeds.h>
+#include <kinematics_test/trajectory_analytics.h>
+
+#define STANDARD_INTERPOLATION_STEP 0.01
+#define EXPERIMENTAL_DISTANCE_CONSTRAINT 0.005
+#define EXPERIMENTAL_ATTEMPT_NUMBER 10
+#define FANUC_M20IA_END_EFFECTOR "link_6"
+#define PLANNING_GROUP "manipulator"
+#define WARM_UP_ITERATIONS 20
+#define WARM_UP_TRACE_RINGS 8
+#define SEEDED_IK_TIMEOUT 0.005
+//Greatest joint motion in radians between two waypoints of a joint space move before refinement
+#define JOINT_INTERPOLATION_STEP 0.05
+//Default of tool_angular_speed, rad/s
+#define NOMINAL_TOOL_ANGULAR_SPEED 1.0
+//Restarts of every IK call in deterministic mode, the first one starts from the current state
+#define DETERMINISTIC_IK_ATTEMPTS 3
+//Greatest swept distance of a clearance adaptive link in metres, far from the world the IK jumps still get bisected
+#define MAX_CLEARANCE_STEP 0.1
+//Zero keeps the timeout of kinematics.yaml
+#define DEFAULT_IK_TIMEOUT 0.0
+
+namespace kinematics_test {
+
+class ControllerResampler;
+
+typedef std::list<robot_state::RobotStatePtr> Trail;
+
+/** How a request may reach its goal. Transfer moves that don't need a straight tool path
+ * can fall back to joint space interpolation between the start state and a goal IK solution */
+enum PathPolicy {
+	PATH_CARTESIAN,
+	PATH_JOINT_FALLBACK,
+	PATH_JOINT
+};
+
+/** Parse cartesian, fallback or joint. Return false on an unknown name */
+bool parsePathPolicy(const std::string& name, PathPolicy& policy);
+const char* pathPolicyName(PathPolicy policy);
+
+/** Everything the pipeline used to take from macros. Defaults reproduce the original node */
+struct PlannerConfig {
+	PlannerConfig();
+
+	std::string planning_group;
+	std::string end_effector;
+	//Cartesian distance between two interpolated waypoints
+	double interpolation_step;
+	//Greatest allowed swept distance of any link between two waypoints
+	double distance_constraint;
+	//Number of consecutive bisections that don't halve the distance before a jump is reported
+	size_t attempt_number;
+	//Timeout of every trac-ik call in seconds
+	double ik_timeout;
+	size_t warm_up_iterations;
+	//Optional learned seed for every interpolation step, trac-ik starts from the previous waypoint otherwise
+	std::shared_ptr<const IkSeedPredictor> seed_predictor;
+	//The seeded attempt gets a short timeout, a miss falls back to the unseeded solve
+	double seeded_ik_timeout;
+	//Live heap bytes a single request may hold, zero for unlimited
+	uint64_t memory_budget_bytes;
+	//IK restarts from seeds derived from the request and the waypoint, see RequestSeeds. Only a replay is bit-identical
+	bool deterministic;
+	//Nominal end effector speed of the analytics stage in m/s and rad/s, zero turns the stage off
+	double tool_speed;
+	double tool_angular_speed;
+	//Analytics limits beyond the robot model, zero leaves them unchecked
+	double max_joint_jerk;
+	double max_cartesian_deviation;
+	//Validate with one padded collision check per segment instead of refining every link to the distance constraint
+	bool padded_collision;
+	//Fraction of its clearance to the environment a link may sweep between two waypoints, zero keeps the
+	//distance constraint everywhere. The distance constraint stays the lower bound near obstacles
+	double clearance_factor;
+	//Rate in Hz the controller samples the time-parameterized trajectory with, zero turns the recheck off
+	double controller_rate;
+};
+
+/** Override the defaults with the parameters found in the namespace of the node handle:
+ * interpolation_step, distance_constraint, attempt_number, ik_timeout, planning_group,
+ * end_effector, warm_up_iterations, seed_model, memory_budget_mb, deterministic, tool_speed,
+ * tool_angular_speed, max_joint_jerk, max_cartesian_deviation, padded_collision, clearance_factor and
+ * controller_rate.
+ * Throws runtime_error on invalid values */
+void loadPlannerConfig(const ros::NodeHandle& node_handle, PlannerConfig& config);
+
+/** The range checks of loadPlannerConfig for a config built in code. Throws runtime_error naming the source */
+void validatePlannerConfig(const PlannerConfig& config, const std::string& source);
+
+/** Interpolate trajectory using slerp quaternion algorithm and linear algorithms
+ * for translation parameter. Return true in case of success. Trail assumed to be empty*/
+bool linearInterpolation(Trail& trail, robot_state::RobotState kinematic_state, const Eigen::Affine3d& goal_transform,
+                         size_t translation_steps, const PlannerConfig& config, bool global_reference_frame = true);
+
+/** Interpolate joint positions linearly from the start state to the IK solution of the goal found from the start
+ * state. Return true in case of success. Trail assumed to be empty */
+bool jointInterpolation(Trail& trail, const robot_state::RobotState& kinematic_state, const Eigen::Affine3d& goal_transform,
+                        const PlannerConfig& config, bool global_reference_frame = true);
+
+/** Joint space interpolation towards a known goal state */
+void jointInterpolation(Trail& trail, const robot_state::RobotState& kinematic_state,
+                        const robot_state::RobotState& goal_state, const PlannerConfig& config);
+
+/** Upper bound of the distance any point of the link travels between two states */
+double getFullTranslation(const robot_state::RobotStatePtr state, const robot_state::RobotStatePtr next_state,
+                          Eigen::Vector3d& link_extends, std::string link_name);
+
+/** Insert waypoints until the link moves less than the distance constraint between neighbours. Joint space
+ * trails are bisected in joint space, Cartesian ones through trac-ik. With a clearance factor and a scene the
+ * link may move that fraction of its getLinkClearance at the first state of a segment instead, up to
+ * MAX_CLEARANCE_STEP. Every segment is recorded in the report of the current RefinementReportScope.
+ * Throws runtime_error when the IK solution jumps */
+void findLinkDistance(Trail& trail, const robot_state::LinkModel* link, const PlannerConfig& config,
+                      bool joint_space = false, const planning_scene::PlanningSceneConstPtr& scene = nullptr);
+
+/** Distance between the link and the world of the scene, or half its distance to another link of the robot
+ * when that is less, as both of them move. Zero or negative in collision */
+double getLinkClearance(const planning_scene::PlanningScene& scene, const robot_state::RobotState& state,
+                        const collision_detection::AllowedCollisionMatrix& link_acm);
+
+/** Allowed collision matrix of the scene that only checks the pairs of the link, for getLinkClearance */
+collision_detection::AllowedCollisionMatrix getLinkClearanceMatrix(const planning_scene::PlanningScene& scene,
+                                                                   const robot_state::LinkModel* link);
+
+/** Greatest getFullTranslation of the link between two neighbouring waypoints */
+double getPeakLinkTranslation(const Trail& trail, const robot_state::LinkModel* link);
+
+/** Throws runtime_error if any state of the trail collides */
+void check_collision(Trail traj, planning_scene::PlanningScenePtr current_scene, std::string planning_group);
+
+/** Check the first state of every segment with each link inflated by its getFullTranslation, which bounds where
+ * the link goes until the end of the segment. Only segments failing the check are bisected, once a segment is
+ * within the distance constraint it's checked unpadded. Segments are reported by their widest link.
+ * Throws runtime_error on collision or IK jump */
+void checkPaddedCollision(Trail& trail, const std::vector<const robot_state::LinkModel*>& links,
+                          const planning_scene::PlanningScenePtr& current_scene, const PlannerConfig& config,
+                          bool joint_space = false);
+
+/** Default joint values moved onto the trac-ik solution of their own end effector pose, the start of every demo move */
+void setToStartState(robot_state::RobotState& kinematic_state, const PlannerConfig& config);
+
+/** Links refined by the pipeline, base_link excluded */
+std::vector<const robot_state::LinkModel*> getRefinedLinks(const robot_model::RobotModelConstPtr& kinematic_model);
+
+class CartesianPathPlanner {
+public:
+	CartesianPathPlanner(const robot_model::RobotModelConstPtr& kinematic_model,
+	                     const planning_scene::PlanningScenePtr& current_scene,
+	                     const PlannerConfig& config = PlannerConfig());
+
+	const PlannerConfig& getConfig() const { return config_; }
+	/** Links of the transform table of a request: the refined links and the end effector */
+	const std::vector<const robot_state::LinkModel*>& getTransformLinks() const { return transform_links_; }
+
+	/** Interpolate from the start state to the goal with the configured step. Return true in case of success */
+	bool interpolate(Trail& trail, const robot_state::RobotState& start_state, const Eigen::Affine3d& goal_transform,
+	                 bool global_reference_frame = true) const;
+
+	/** Refine every link while validating the trail in parallel, or densify only where padded checks fail with
+	 * padded_collision. Throws runtime_error on invalid trajectory, the collision worker has finished by then */
+	void refine(Trail& trail, bool joint_space = false) const;
+
+	/** Full pipeline. Return true in case of success, the trail is cleared otherwise. With PATH_JOINT_FALLBACK a
+	 * failed Cartesian move is planned again in joint space, the current RefinementReport is cleared before. Allocations are accounted to the given memory
+	 * (or an internal one with the configured budget) and the request fails once it exceeds its budget. In deterministic mode the IK
+	 * calls use the seeds of the current SeedRequestScope, or seeds of an unnamed request without one.
+	 * With a tool speed the analytics stage fills the metrics and rejects trajectories over the limits. With a
+	 * controller rate trajectories colliding between their waypoints at that rate are rejected too. The given
+	 * trajectory receives the timed waypoints to send to the controller, with a controller rate the very timing
+	 * that was checked. Link transforms are read from the table of the current LinkTransformScope, or a table of
+	 * the request without one */
+	bool plan(Trail& trail, const robot_state::RobotState& start_state, const Eigen::Affine3d& goal_transform,
+	          bool global_reference_frame = true, PathPolicy policy = PATH_CARTESIAN,
+	          RequestMemory* memory = nullptr, TrajectoryMetrics* metrics = nullptr,
+	          robot_trajectory::RobotTrajectory* trajectory = nullptr) const;
+
+	/** Joint space move to a given state, refined and validated like plan(), the analytics and resampling stages
+	 * included. Return true in case of success, the trail is cleared otherwise */
+	bool planJointMove(Trail& trail, const robot_state::RobotState& start_state,
+	                   const robot_state::RobotState& goal_state) const;
+
+	/** Run representative queries so the first request runs at steady-state speed */
+	void warmUp(const robot_state::RobotState& kinematic_state) const;
+
+	std::vector<geometry_msgs::Pose> toPoses(const Trail& trail) const;
+	robot_trajectory::RobotTrajectoryPtr toRobotTrajectory(const Trail& trail) const;
+
+private:
+	/** One attempt of the pipeline in the given space, an exception of any pipeline thread is turned into false */
+	bool planInSpace(Trail& trail, const robot_state::RobotState& start_state, const Eigen::Affine3d& goal_transform,
+	                 bool global_reference_frame, bool joint_space) const;
+	/** Analytics and resampling stages of a refined trail, return false if either rejects it. The trajectory
+	 * receives the checked timing, or the plain time parameterization without a controller rate */
+	bool validateExecution(const Trail& trail, bool cartesian, TrajectoryMetrics* metrics,
+	                       robot_trajectory::RobotTrajectory* trajectory) const;
+
+	robot_model::RobotModelConstPtr kinematic_model_;
+	planning_scene::PlanningScenePtr current_scene_;
+	PlannerConfig config_;
+	TrajectoryAnalyzer analyzer_;
+	std::vector<const robot_state::LinkModel*> transform_links_;
+	//Only built with a controller rate
+	std::shared_ptr<const ControllerResampler> resampler_;
+};
+
+}
+
+#endif //KINEMATICS_TEST_CARTESIAN_PATH_PLANNER_H
@@ -0,0 +1,262 @@
+/*********************************************************************
+ * Compact joint trajectories for bulk offline validation. Trajectories
+ * are stored as contiguous float32 (or float64) joint buffers, and the
+ * forward kinematics and link distance kernels run directly on them in
+ * the stored precision, with the refined links reduced to a chain of
+ * joint origins and axes.
+ *
+ * The float kernel comes with an explicit bound on its error against
+ * exact arithmetic. Segments whose swept distance is within the bound
+ * of the limit are computed again in double precision, so the verdict
+ * is the one double precision would give for the stored positions.
+ *********************************************************************/
+
+#ifndef KINEMATICS_TEST_COMPACT_TRAJECTORY_H
+#define KINEMATICS_TEST_COMPACT_TRAJECTORY_H
+
+#include <cstdint>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <Eigen/Dense>
+#include <kinematics_test/cartesian_path_planner.h>
+
+//Multiplies joint count * epsilon * length scale in the error bound of a kernel
+#define COMPACT_ERROR_FACTOR 16
+#define COMPACT_TRAJECTORY_MAGIC 0x5443544b
+
+namespace kinematics_test {
+
+/** Joint positions of one trajectory, waypoint after waypoint */
+template <typename Scalar>
+struct CompactTrajectory {
+	std::string id;
+	uint32_t joint_count;
+	std::vector<Scalar> positions;
+
+	size_t size() const { return joint_count ? positions.size() / joint_count : 0; }
+	const Scalar* waypoint(size_t waypoint_idx) const { return &positions[waypoint_idx * joint_count]; }
+};
+
+template <typename Scalar>
+CompactTrajectory<Scalar> compactTrail(const Trail& trail, const robot_state::JointModelGroup* jmg_ptr,
+                                       const std::string& id){
+	CompactTrajectory<Scalar> trajectory;
+	trajectory.id = id;
+	trajectory.joint_count = jmg_ptr->getVariableCount();
+	trajectory.positions.reserve(trail.size() * trajectory.joint_count);
+	std::vector<double> positions;
+	for (const robot_state::RobotStatePtr& state : trail){
+		state->copyJointGroupPositions(jmg_ptr, positions);
+		trajectory.positions.insert(trajectory.positions.end(), positions.begin(), positions.end());
+	}
+	return trajectory;
+}
+
+/** Every record carries the magic and the scalar size, so libraries can be appended to by several runs */
+template <typename Scalar>
+void writeCompactTrajectory(std::ostream& library, const CompactTrajectory<Scalar>& trajectory){
+	uint32_t magic = COMPACT_TRAJECTORY_MAGIC;
+	uint8_t scalar_size = sizeof(Scalar);
+	uint32_t id_size = trajectory.id.size();
+	uint32_t waypoint_count = trajectory.size();
+	library.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+	library.write(reinterpret_cast<const char*>(&scalar_size), sizeof(scalar_size));
+	library.write(reinterpret_cast<const char*>(&id_size), sizeof(id_size));
+	library.write(trajectory.id.data(), id_size);
+	library.write(reinterpret_cast<const char*>(&trajectory.joint_count), sizeof(trajectory.joint_count));
+	library.write(reinterpret_cast<const char*>(&waypoint_count), sizeof(waypoint_count));
+	library.write(reinterpret_cast<const char*>(trajectory.positions.data()), trajectory.positions.size() * sizeof(Scalar));
+}
+
+/** Return false at the end of the library or at a record cut short by a crash.
+ * Throws runtime_error on a record of another scalar type or a corrupted one */
+template <typename Scalar>
+bool readCompactTrajectory(std::istream& library, CompactTrajectory<Scalar>& trajectory){
+	uint32_t magic, id_size, waypoint_count;
+	uint8_t scalar_size;
+	if (!library.read(reinterpret_cast<char*>(&magic), sizeof(magic)))
+		return false;
+	if (magic != COMPACT_TRAJECTORY_MAGIC)
+		throw std::runtime_error("Corrupted compact trajectory record");
+	if (!library.read(reinterpret_cast<char*>(&scalar_size), sizeof(scalar_size)) ||
+			!library.read(reinterpret_cast<char*>(&id_size), sizeof(id_size)))
+		return false;
+	if (scalar_size != sizeof(Scalar))
+		throw std::runtime_error("Compact trajectory stored with another precision");
+	trajectory.id.resize(id_size);
+	if (!library.read(&trajectory.id[0], id_size) ||
+			!library.read(reinterpret_cast<char*>(&trajectory.joint_count), sizeof(trajectory.joint_count)) ||
+			!library.read(reinterpret_cast<char*>(&waypoint_count), sizeof(waypoint_count)))
+		return false;
+	trajectory.positions.resize((size_t)waypoint_count * trajectory.joint_count);
+	return (bool)library.read(reinterpret_cast<char*>(trajectory.positions.data()),
+	                          trajectory.positions.size() * sizeof(Scalar));
+}
+
+/** One joint of the chain in its parent link frame. The joint frame is the frame of its child link */
+struct ChainJoint {
+	Eigen::Isometry3d origin;
+	Eigen::Vector3d axis;
+	//Position in the joint buffer, -1 for fixed joints
+	int variable_idx;
+	bool prismatic;
+	//Earlier joint the parent link hangs on, -1 at the root
+	int parent;
+
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+typedef std::vector<ChainJoint, Eigen::aligned_allocator<ChainJoint>> ChainJoints;
+
+struct SweptVerification {
+	size_t segments;
+	//Segments within the error bound of the limit, computed again in double precision
+	size_t verified_segments;
+	size_t violations;
+	//Greatest swept distance of any link, from the double pass where one was made
+	double peak_swept_distance;
+};
+
+/** Forward kinematics of the refined links without a RobotState, templated on the stored precision */
+class ChainKinematics {
+public:
+	/** Throws runtime_error if a link hangs on a joint other than fixed, revolute or prismatic */
+	ChainKinematics(const robot_state::JointModelGroup* jmg_ptr, const std::vector<const robot_state::LinkModel*>& links);
+
+	size_t getLinkCount() const { return link_joints_.size(); }
+
+	/** Bound of |swept distance in Scalar - exact swept distance| for the stored positions */
+	template <typename Scalar>
+	double sweptErrorBound() const{
+		return COMPACT_ERROR_FACTOR * joints_.size() * std::numeric_limits<Scalar>::epsilon() *
+				(3 * reach_ + link_diagonals_.maxCoeff());
+	}
+
+	/** Frames of the refined links at one waypoint, one column per link, quaternions as x, y, z, w */
+	template <typename Scalar>
+	void linkPoses(const Scalar* positions, Eigen::Matrix<Scalar, 3, Eigen::Dynamic>& translations,
+	               Eigen::Matrix<Scalar, 4, Eigen::Dynamic>& orientations) const{
+		typedef Eigen::Transform<Scalar, 3, Eigen::Isometry> Frame;
+		typedef Eigen::Matrix<Scalar, 3, 1> Vector;
+		std::vector<Frame, Eigen::aligned_allocator<Frame>> frames(joints_.size());
+		for (size_t joint_idx = 0; joint_idx < joints_.size(); ++joint_idx){
+			const ChainJoint& joint = joints_[joint_idx];
+			Frame& frame = frames[joint_idx];
+			frame = joint.parent < 0 ? origins<Scalar>()[joint_idx] : frames[joint.parent] * origins<Scalar>()[joint_idx];
+			if (joint.variable_idx < 0)
+				continue;
+			Vector axis = joint.axis.cast<Scalar>();
+			if (joint.prismatic)
+				frame.translate(axis * positions[joint.variable_idx]);
+			else
+				frame.rotate(Eigen::AngleAxis<Scalar>(positions[joint.variable_idx], axis));
+		}
+		translations.resize(3, link_joints_.size());
+		orientations.resize(4, link_joints_.size());
+		for (size_t link_idx = 0; link_idx < link_joints_.size(); ++link_idx){
+			const Frame& frame = frames[link_joints_[link_idx]];
+			translations.col(link_idx) = frame.translation();
+			orientations.col(link_idx) = Eigen::Quaternion<Scalar>(frame.rotation()).coeffs();
+		}
+	}
+
+	/** getFullTranslation of every link (rows) over every segment (columns) */
+	template <typename Scalar>
+	void sweptDistances(const CompactTrajectory<Scalar>& trajectory,
+	                    Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& swept) const{
+		size_t waypoint_count = trajectory.size();
+		size_t link_count = link_joints_.size();
+		swept.resize(link_count, waypoint_count > 0 ? waypoint_count - 1 : 0);
+		if (waypoint_count < 2)
+			return;
+		Eigen::Matrix<Scalar, 3, Eigen::Dynamic> translations[2];
+		Eigen::Matrix<Scalar, 4, Eigen::Dynamic> orientations[2];
+		linkPoses(trajectory.waypoint(0), translations[0], orientations[0]);
+		for (size_t segment = 0; segment + 1 < waypoint_count; ++segment){
+			const size_t current = segment % 2, next = 1 - current;
+			linkPoses(trajectory.waypoint(segment + 1), translations[next], orientations[next]);
+			swept.col(segment) = sweptDistance(translations[current], orientations[current],
+			                                   translations[next], orientations[next]).matrix();
+		}
+	}
+
+	/** getFullTranslation of every link between two sets of link poses from linkPoses */
+	template <typename Scalar>
+	Eigen::Array<Scalar, Eigen::Dynamic, 1> sweptDistance(const Eigen::Matrix<Scalar, 3, Eigen::Dynamic>& translations,
+	                                                      const Eigen::Matrix<Scalar, 4, Eigen::Dynamic>& orientations,
+	                                                      const Eigen::Matrix<Scalar, 3, Eigen::Dynamic>& next_translations,
+	                                                      const Eigen::Matrix<Scalar, 4, Eigen::Dynamic>& next_orientations)
+			const{
+		//Same hemisphere, then 2 atan2(|a - b|, |a + b|), which stays accurate for the tiny angles between waypoints
+		Eigen::Array<Scalar, 1, Eigen::Dynamic> signs =
+				(orientations.array() * next_orientations.array()).colwise().sum().sign();
+		signs = (signs == Scalar(0)).select(Scalar(1), signs);
+		Eigen::Matrix<Scalar, 4, Eigen::Dynamic> aligned = (next_orientations.array().rowwise() * signs).matrix();
+		Eigen::Array<Scalar, Eigen::Dynamic, 1> angles = 2 * (orientations - aligned).colwise().norm()
+				.array().binaryExpr((orientations + aligned).colwise().norm().array(),
+				                    [](Scalar y, Scalar x){ return std::atan2(y, x); }).transpose();
+		typedef Eigen::Array<Scalar, Eigen::Dynamic, 1> Distances;
+		return fullTranslationBound<Distances>((next_translations - translations).colwise().norm().transpose().array(),
+		                                       translations.colwise().norm().transpose().array(),
+		                                       link_diagonals_.cast<Scalar>().array(), angles);
+	}
+
+	/** Check every segment against the limit in Scalar, segments within the error bound again in double */
+	template <typename Scalar>
+	SweptVerification verifySweptDistances(const CompactTrajectory<Scalar>& trajectory, double limit) const{
+		SweptVerification verification = {0, 0, 0, 0.0};
+		Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> swept;
+		sweptDistances(trajectory, swept);
+		verification.segments = swept.cols();
+		double bound = sweptErrorBound<Scalar>();
+		CompactTrajectory<double> segment_trajectory;
+		segment_trajectory.joint_count = trajectory.joint_count;
+		Eigen::MatrixXd exact_swept;
+		for (size_t segment = 0; segment < (size_t)swept.cols(); ++segment){
+			double peak = swept.col(segment).maxCoeff();
+			if (std::abs(peak - limit) <= bound){
+				const Scalar* segment_positions = trajectory.waypoint(segment);
+				segment_trajectory.positions.assign(segment_positions, segment_positions + 2 * trajectory.joint_count);
+				sweptDistances(segment_trajectory, exact_swept);
+				peak = exact_swept.maxCoeff();
+				verification.verified_segments++;
+			}
+			verification.violations += peak > limit;
+			verification.peak_swept_distance = std::max(verification.peak_swept_distance, peak);
+		}
+		return verification;
+	}
+
+private:
+	template <typename Scalar>
+	const std::vector<Eigen::Transform<Scalar, 3, Eigen::Isometry>,
+	                  Eigen::aligned_allocator<Eigen::Transform<Scalar, 3, Eigen::Isometry>>>& origins() const;
+
+	ChainJoints joints_;
+	std::vector<size_t> link_joints_;
+	Eigen::VectorXd link_diagonals_;
+	//Sum of the origin offsets, bounds the distance of any link from the root
+	double reach_;
+	std::vector<Eigen::Isometry3f, Eigen::aligned_allocator<Eigen::Isometry3f>> float_origins_;
+	std::vector<Eigen::Isometry3d, Eigen::aligned_allocator<Eigen::Isometry3d>> double_origins_;
+};
+
+template <>
+inline const std::vector<Eigen::Isometry3f, Eigen::aligned_allocator<Eigen::Isometry3f>>&
+ChainKinematics::origins<float>() const{
+	return float_origins_;
+}
+
+template <>
+inline const std::vector<Eigen::Isometry3d, Eigen::aligned_allocator<Eigen::Isometry3d>>&
+ChainKinematics::origins<double>() const{
+	return double_origins_;
+}
+
+}
+
+#endif //KINEMATICS_TEST_COMPACT_TRAJECTORY_H
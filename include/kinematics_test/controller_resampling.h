@@ -0,0 +1,66 @@
+/*********************************************************************
+ * Check of the motion the controller actually executes between two
+ * validated waypoints. The trail is time-parameterized, then sampled at
+ * the controller rate with the quintic splines a joint trajectory
+ * controller builds from positions, velocities and accelerations.
+ *
+ * Forward kinematics of the samples runs on the ChainKinematics of the
+ * refined links. A sample is flagged when some link is farther from
+ * its pose at the segment start than the refinement allowed for that
+ * segment. Only the flagged intervals get full collision queries.
+ *
+ * The checked timing is handed back to the caller, the controller is
+ * sent exactly the motion that was validated.
+ *********************************************************************/
+
+#ifndef KINEMATICS_TEST_CONTROLLER_RESAMPLING_H
+#define KINEMATICS_TEST_CONTROLLER_RESAMPLING_H
+
+#include <string>
+#include <vector>
+#include <moveit/robot_model/robot_model.h>
+#include <moveit/planning_scene/planning_scene.h>
+#include <moveit/robot_trajectory/robot_trajectory.h>
+#include <kinematics_test/cartesian_path_planner.h>
+#include <kinematics_test/compact_trajectory.h>
+
+namespace kinematics_test {
+
+struct ResamplingReport {
+	//Execution time given by the time parameterization
+	double duration;
+	size_t sample_count;
+	//Segments with a sample outside the swept distance validated for them
+	size_t flagged_segments;
+	size_t collision_queries;
+	//Empty if every flagged sample is collision free
+	std::string violation;
+};
+
+/** Waypoints of the trail with the iterative parabolic timing, velocities and accelerations a controller is sent.
+ * Return false if the time parameterization fails */
+bool timeTrail(const Trail& trail, robot_trajectory::RobotTrajectory& trajectory);
+
+class ControllerResampler {
+public:
+	/** Throws runtime_error if a refined link hangs on a joint ChainKinematics doesn't support */
+	ControllerResampler(const robot_model::RobotModelConstPtr& kinematic_model, const std::string& planning_group,
+	                    const std::vector<const robot_state::LinkModel*>& links, double distance_constraint,
+	                    double controller_rate);
+
+	/** Fill the report, the violation names the first colliding sample or a failed time parameterization.
+	 * The trajectory receives the timed waypoints that were checked */
+	void check(const Trail& trail, const planning_scene::PlanningScene& scene,
+	           robot_trajectory::RobotTrajectory& trajectory, ResamplingReport& report) const;
+
+private:
+	robot_model::RobotModelConstPtr kinematic_model_;
+	const robot_state::JointModelGroup* jmg_ptr_;
+	ChainKinematics chain_;
+	double distance_constraint_;
+	double controller_rate_;
+};
+
+}
+
+#endif //KINEMATICS_TEST_CONTROLLER_RESAMPLING_H
@@ -0,0 +1,126 @@
+/*********************************************************************
+ * Watches a validated trail while the controller executes it. The
+ * monitor has its own scene monitor, which follows the joint states,
+ * the planning scene topics and the world geometry sensors. Every
+ * update wakes the monitor thread. The thread moves the current
+ * waypoint forward to the one nearest to the robot and checks the
+ * waypoints of the horizon ahead against the world.
+ *
+ * The planner already ruled out self collisions, so only the world is
+ * queried. Every link is padded by the greatest distance it sweeps
+ * between two waypoints of the monitored trail. That is more than the
+ * distance constraint after padded or clearance adaptive refinement.
+ * The padding lives in a child scene of the monitor, rebuilt for a new
+ * trail or world, so the paddings of scene messages don't override it.
+ * Results stay valid until the world geometry changes, so while it
+ * doesn't only the waypoints entering the horizon are checked.
+ *
+ * A collision within the stop distance raises a stop, one further ahead
+ * a replan. A check still running at the latency budget after the
+ * update raises a stop too. The horizon bounds the work of one check.
+ *********************************************************************/
+
+#ifndef KINEMATICS_TEST_EXECUTION_MONITOR_H
+#define KINEMATICS_TEST_EXECUTION_MONITOR_H
+
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <moveit/planning_scene_monitor/planning_scene_monitor.h>
+#include <kinematics_test/cartesian_path_planner.h>
+
+namespace kinematics_test {
+
+enum MonitorSignal {
+	MONITOR_CLEAR,
+	MONITOR_REPLAN,
+	MONITOR_STOP
+};
+
+const char* monitorSignalName(MonitorSignal signal);
+
+struct MonitorEvent {
+	MonitorSignal signal;
+	size_t current_waypoint;
+	//Size of the trail when the signal isn't caused by a collision
+	size_t colliding_waypoint;
+	//From the first update the check serves to the decision
+	double latency_ms;
+	size_t collision_queries;
+	std::string reason;
+};
+
+struct MonitorConfig {
+	std::string planning_group;
+	//Waypoints ahead of the current one checked after every update
+	size_t horizon;
+	//A collision closer than this many waypoints stops the robot, a farther one asks for a replan
+	size_t stop_waypoints;
+	double latency_budget_ms;
+};
+
+class ExecutionMonitor {
+public:
+	typedef std::function<void(const MonitorEvent&)> SignalCallback;
+
+	/** The scene monitor gets an update callback, its monitors must be started by the caller */
+	ExecutionMonitor(const planning_scene_monitor::PlanningSceneMonitorPtr& live_scene,
+	                 const std::vector<const robot_state::LinkModel*>& links, const MonitorConfig& config,
+	                 const SignalCallback& signal_callback);
+	~ExecutionMonitor();
+
+	/** Monitor the trail from its first waypoint on, the previous trail is forgotten */
+	void setTrail(const Trail& trail);
+	void clear();
+
+	size_t getCurrentWaypoint() const;
+
+private:
+	/** Waypoints with random access and their joint positions column by column */
+	struct MonitoredTrail {
+		std::vector<robot_state::RobotStatePtr> waypoints;
+		Eigen::MatrixXd positions;
+		//Peak translation of every monitored link between two waypoints
+		std::map<std::string, double> paddings;
+	};
+
+	void onSceneUpdate(planning_scene_monitor::PlanningSceneMonitor::SceneUpdateType type);
+	void run();
+	/** Advance the current waypoint and check the horizon from the first waypoint not checked against the world.
+	 * Called with the scene locked */
+	MonitorEvent check(const planning_scene::PlanningScene& scene, const MonitoredTrail& trail,
+	                   size_t& current_waypoint, size_t& checked_until,
+	                   std::chrono::steady_clock::time_point update_time) const;
+
+	planning_scene_monitor::PlanningSceneMonitorPtr live_scene_;
+	MonitorConfig config_;
+	SignalCallback signal_callback_;
+	const robot_state::JointModelGroup* jmg_ptr_;
+	std::vector<const robot_state::LinkModel*> links_;
+
+	mutable std::mutex mutex_;
+	std::condition_variable update_condition_;
+	bool running_;
+	bool pending_;
+	//Counts the changes of the world geometry, a check only caches its results if the world stayed the same
+	uint64_t world_generation_;
+	std::chrono::steady_clock::time_point pending_since_;
+	std::shared_ptr<const MonitoredTrail> trail_;
+	size_t current_waypoint_;
+	//Waypoints before this index were checked against the current world
+	size_t checked_until_;
+	//The strongest signal raised for the trail, weaker ones aren't repeated
+	MonitorSignal raised_signal_;
+	std::thread thread_;
+};
+
+}
+
+#endif //KINEMATICS_TEST_EXECUTION_MONITOR_H
@@ -0,0 +1,67 @@
+/*********************************************************************
+ * Small multilayer perceptron predicting the joint step that moves the
+ * end effector from its current pose to the target pose. The prediction
+ * seeds trac-ik, so hard waypoints don't spend the timeout on random
+ * restarts. Trained offline by ik_seed_trainer.
+ *********************************************************************/
+
+#ifndef KINEMATICS_TEST_IK_SEED_PREDICTOR_H
+#define KINEMATICS_TEST_IK_SEED_PREDICTOR_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <Eigen/Geometry>
+
+//Translation and rotation vector of the pose step, sin and cos of every joint
+#define SEED_PREDICTOR_JOINTS 6
+#define SEED_PREDICTOR_INPUTS (6 + 2 * SEED_PREDICTOR_JOINTS)
+#define SEED_PREDICTOR_HIDDEN 32
+
+namespace kinematics_test {
+
+/** Fixed-size weights, row-major, so inference is a few tight loops the compiler vectorizes */
+struct SeedPredictorWeights {
+	double input_mean[SEED_PREDICTOR_INPUTS];
+	double input_scale[SEED_PREDICTOR_INPUTS];
+	double hidden_weights[SEED_PREDICTOR_HIDDEN][SEED_PREDICTOR_INPUTS];
+	double hidden_bias[SEED_PREDICTOR_HIDDEN];
+	double output_weights[SEED_PREDICTOR_JOINTS][SEED_PREDICTOR_HIDDEN];
+	double output_bias[SEED_PREDICTOR_JOINTS];
+};
+
+class IkSeedPredictor {
+public:
+	struct Statistics {
+		Statistics();
+		std::atomic<uint64_t> seeded_attempts;
+		std::atomic<uint64_t> seeded_successes;
+		std::atomic<uint64_t> fallback_attempts;
+		std::atomic<uint64_t> fallback_successes;
+		std::atomic<uint64_t> ik_nanoseconds;
+	};
+
+	IkSeedPredictor();
+	//Throws runtime_error if the file can't be read or doesn't match the fixed sizes
+	explicit IkSeedPredictor(const std::string& path);
+
+	void save(const std::string& path) const;
+
+	static void computeFeatures(const Eigen::Affine3d& current_pose, const Eigen::Affine3d& target_pose,
+	                            const double* joint_positions, double* features);
+
+	/** Write the predicted seed, previous joints plus predicted step */
+	void predict(const Eigen::Affine3d& current_pose, const Eigen::Affine3d& target_pose,
+	             const double* joint_positions, double* seed) const;
+	//Predicted joint step from already normalized features, also used by the trainer
+	void forward(const double* normalized_features, double* hidden, double* step) const;
+
+	void report() const;
+
+	SeedPredictorWeights weights;
+	mutable Statistics statistics;
+};
+
+}
+
+#endif //KINEMATICS_TEST_IK_SEED_PREDICTOR_H
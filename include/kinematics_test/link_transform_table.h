@@ -0,0 +1,97 @@
+/*********************************************************************
+ * Forward kinematics computed once per waypoint. The table keeps the
+ * joint positions of every waypoint next to the translations and
+ * orientations of the cached links, column after column. The swept
+ * distance of the refinement passes, the analytics buffers and the
+ * pose extraction read from here instead of the robot states.
+ *
+ * A waypoint is found by its state, the two most recent ones without a
+ * hash lookup. Its transforms are computed again only if the joint
+ * positions of the state changed since they were cached, they are
+ * compared in place.
+ *********************************************************************/
+
+#ifndef KINEMATICS_TEST_LINK_TRANSFORM_TABLE_H
+#define KINEMATICS_TEST_LINK_TRANSFORM_TABLE_H
+
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+#include <Eigen/Geometry>
+#include <moveit/robot_model/robot_model.h>
+#include <moveit/robot_state/robot_state.h>
+
+namespace kinematics_test {
+
+/** Lever formula of getFullTranslation: the distance the link origin moves plus the origin's distance from the base
+ * and the link diagonal turned by the angle between the orientations. For scalars or arrays of segments */
+template <typename T>
+T fullTranslationBound(const T& translation_distance, const T& origin_distance, const T& link_diagonal,
+                       const T& angle){
+	using std::sin;
+	return translation_distance + (origin_distance + link_diagonal) * sin(angle);
+}
+
+class LinkTransformTable {
+public:
+	LinkTransformTable(const robot_state::JointModelGroup* jmg_ptr,
+	                   const std::vector<const robot_state::LinkModel*>& links);
+
+	/** Position of the link in the table, -1 if it isn't cached */
+	int linkIndex(const robot_state::LinkModel* link) const;
+
+	/** Column of the waypoint. The state is updated, so collision checks don't compute its transforms again */
+	size_t waypoint(const robot_state::RobotStatePtr& state);
+
+	Eigen::Map<const Eigen::VectorXd> jointPositions(size_t waypoint_idx) const{
+		return Eigen::Map<const Eigen::VectorXd>(joint_positions_.col(waypoint_idx).data(), joint_positions_.rows());
+	}
+	Eigen::Vector3d translation(size_t waypoint_idx, size_t link_idx) const{
+		return translations_.col(waypoint_idx * links_.size() + link_idx);
+	}
+	//Quaternion coefficients x, y, z, w
+	Eigen::Vector4d orientation(size_t waypoint_idx, size_t link_idx) const{
+		return orientations_.col(waypoint_idx * links_.size() + link_idx);
+	}
+	Eigen::Affine3d transform(size_t waypoint_idx, size_t link_idx) const;
+
+	/** getFullTranslation of the link between two waypoints of the table */
+	double fullTranslation(size_t waypoint_idx, size_t next_waypoint_idx, size_t link_idx) const;
+
+	size_t size() const { return states_.size(); }
+	void clear();
+
+private:
+	void reserve(size_t waypoint_count);
+	void remember(const robot_state::RobotState* state, size_t waypoint_idx);
+
+	const robot_state::JointModelGroup* jmg_ptr_;
+	std::vector<const robot_state::LinkModel*> links_;
+	//Diagonal of the extents of every link, the lever arm of getFullTranslation
+	Eigen::VectorXd link_diagonals_;
+	//The states are held, so their addresses can't be reused by new waypoints
+	std::vector<robot_state::RobotStatePtr> states_;
+	std::unordered_map<const robot_state::RobotState*, size_t> indices_;
+	//Most recent first. The refinement asks for the same neighbours over and over
+	const robot_state::RobotState* recent_states_[2];
+	size_t recent_indices_[2];
+	Eigen::MatrixXd joint_positions_;
+	Eigen::Matrix3Xd translations_;
+	Eigen::Matrix4Xd orientations_;
+};
+
+/** Makes the table current for the pipeline stages of the calling thread until destruction */
+class LinkTransformScope {
+public:
+	explicit LinkTransformScope(LinkTransformTable* transforms);
+	~LinkTransformScope();
+
+	static LinkTransformTable* current();
+
+private:
+	LinkTransformTable* previous_;
+};
+
+}
+
+#endif //KINEMATICS_TEST_LINK_TRANSFORM_TABLE_H
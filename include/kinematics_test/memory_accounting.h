@@ -0,0 +1,71 @@
+/*********************************************************************
+ * Allocation accounting per planning request and pipeline stage.
+ * Allocations made by a thread that has adopted a request are
+ * attributed to that request and to the stage the thread is in. The
+ * counting is done by the operator new/delete replacements of
+ * allocation_hooks.cpp, which only the offline tools compile in. The
+ * library and the nodelet leave the allocator of the process alone,
+ * without the hooks the counters stay zero and no budget is enforced.
+ * Threads without a request only pay one thread-local load.
+ *********************************************************************/
+
+#ifndef KINEMATICS_TEST_MEMORY_ACCOUNTING_H
+#define KINEMATICS_TEST_MEMORY_ACCOUNTING_H
+
+#include <atomic>
+#include <cstdint>
+#include <kinematics_test/perf_counters.h>
+
+namespace kinematics_test {
+
+class RequestMemory {
+public:
+	//Zero budget means unlimited
+	explicit RequestMemory(uint64_t budget_bytes = 0);
+
+	void onAllocate(uint64_t bytes, PipelineStage stage);
+	void onFree(uint64_t bytes);
+
+	/** Throws runtime_error once the live bytes of the request went over the budget */
+	void checkBudget() const;
+
+	uint64_t budget_bytes;
+	std::atomic<uint64_t> allocations;
+	std::atomic<uint64_t> allocated_bytes;
+	//Frees are matched against the request of the freeing thread, so live bytes are an estimate
+	std::atomic<int64_t> live_bytes;
+	std::atomic<int64_t> peak_live_bytes;
+	std::atomic<uint64_t> stage_bytes[STAGE_COUNT + 1];
+	std::atomic<bool> budget_exceeded;
+	//Process resident set high-water mark when the request finished
+	uint64_t peak_rss_bytes;
+};
+
+/** Attributes the allocations of the calling thread to the request until destruction */
+class MemoryRequestScope {
+public:
+	explicit MemoryRequestScope(RequestMemory* memory);
+	~MemoryRequestScope();
+
+	static RequestMemory* current();
+
+private:
+	RequestMemory* previous_;
+};
+
+/** Stage of the calling thread for the attribution, maintained by PerfStageScope */
+PipelineStage& currentMemoryStage();
+
+/** Attribute a block to the request of the calling thread, called by the allocation hooks */
+void accountAllocation(void* ptr);
+void accountFree(void* ptr);
+
+/** Called by the allocation hooks on startup, the budget of a request can only be enforced after it */
+void installAllocationAccounting();
+bool isAllocationAccountingInstalled();
+
+uint64_t getPeakRssBytes();
+
+}
+
+#endif //KINEMATICS_TEST_MEMORY_ACCOUNTING_H
@@ -0,0 +1,96 @@
+/*********************************************************************
+ * Optional hardware performance counters per pipeline stage. Every
+ * thread opens its own perf_event_open group (cycles, instructions,
+ * cache misses, branch misses) and accumulates the deltas of the stage
+ * scopes it runs. When a thread exits its group is closed and its
+ * statistics are folded into the ones of its label, so the one-shot
+ * collision workers of every request don't pile up. Disabled scopes
+ * cost one relaxed load plus marking the stage for the memory
+ * accounting.
+ *********************************************************************/
+
+#ifndef KINEMATICS_TEST_PERF_COUNTERS_H
+#define KINEMATICS_TEST_PERF_COUNTERS_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace kinematics_test {
+
+enum PipelineStage {
+	STAGE_INTERPOLATION,
+	STAGE_LINK_DISTANCE,
+	STAGE_COLLISION,
+	STAGE_ANALYTICS,
+	STAGE_PADDED_COLLISION,
+	STAGE_RESAMPLING,
+	STAGE_COUNT
+};
+
+enum PerfCounter {
+	COUNTER_CYCLES,
+	COUNTER_INSTRUCTIONS,
+	COUNTER_CACHE_MISSES,
+	COUNTER_BRANCH_MISSES,
+	COUNTER_COUNT
+};
+
+struct StageSample {
+	uint64_t calls;
+	uint64_t nanoseconds;
+	uint64_t counters[COUNTER_COUNT];
+};
+
+/** Aggregate of one live thread. Only that thread adds to it, reset() and report() read it meanwhile */
+class ThreadPerfStatistics {
+public:
+	ThreadPerfStatistics(const std::string& thread_label, bool has_counters);
+
+	//Counters may be null when the group couldn't be read
+	void add(PipelineStage stage, uint64_t nanoseconds, const uint64_t* counters);
+	StageSample getSample(PipelineStage stage) const;
+	void clear();
+
+	const std::string thread_label;
+	const bool has_counters;
+
+private:
+	std::atomic<uint64_t> calls_[STAGE_COUNT];
+	std::atomic<uint64_t> nanoseconds_[STAGE_COUNT];
+	std::atomic<uint64_t> counters_[STAGE_COUNT][COUNTER_COUNT];
+};
+
+class PerfCounters {
+public:
+	/** Start collecting. Threads without perf_event_open permission still record wall time */
+	static void enable();
+	static bool isEnabled();
+	//Clears the live threads and forgets the exited ones
+	static void reset();
+	//Print per-thread and per-stage cycles, IPC, cache and branch misses
+	static void report();
+
+	static const char* stageName(PipelineStage stage);
+
+private:
+	static std::atomic<bool> enabled_;
+};
+
+/** Adds the counter deltas between construction and destruction to the stage of the calling thread */
+class PerfStageScope {
+public:
+	explicit PerfStageScope(PipelineStage stage);
+	~PerfStageScope();
+
+private:
+	PipelineStage stage_;
+	PipelineStage previous_stage_;
+	bool active_;
+	uint64_t start_ns_;
+	uint64_t start_counters_[COUNTER_COUNT];
+};
+
+}
+
+#endif //KINEMATICS_TEST_PERF_COUNTERS_H
@@ -0,0 +1,76 @@
+/*********************************************************************
+ * Explains the waypoints inserted by the refinement. While a report is
+ * current, every segment a refinement pass visits adds one record: the
+ * link, the swept distance before and after bisection, the number of
+ * bisections and the jump counter of findLinkDistance.
+ *
+ * Reports are saved as CSV or JSON and drawn in RViz as one line list
+ * per link, each segment coloured by its bisections from blue to red.
+ *********************************************************************/
+
+#ifndef KINEMATICS_TEST_REFINEMENT_REPORT_H
+#define KINEMATICS_TEST_REFINEMENT_REPORT_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include <Eigen/Geometry>
+#include <visualization_msgs/MarkerArray.h>
+
+namespace kinematics_test {
+
+struct RefinementRecord {
+	std::string link;
+	//Index of the segment in the trail when the pass over the link reached it, earlier passes shift it
+	size_t segment;
+	double initial_distance;
+	//Swept distance the segment had to get under, the distance constraint unless clearance adaptive
+	double allowed_distance;
+	size_t bisections;
+	double final_distance;
+	//Jump counter after the segment, the trajectory is rejected once it reaches attempt_number
+	size_t attempt;
+	//Link origin at both ends of the segment before its bisection
+	Eigen::Vector3d start_position;
+	Eigen::Vector3d end_position;
+
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+class RefinementReport {
+public:
+	void add(const RefinementRecord& record);
+	void clear();
+
+	const std::vector<RefinementRecord, Eigen::aligned_allocator<RefinementRecord>>& getRecords() const{
+		return records_;
+	}
+	size_t getBisectionCount() const;
+
+	void writeCsv(std::ostream& output) const;
+	void writeJson(std::ostream& output) const;
+	/** JSON if the path ends with .json, CSV otherwise. Throws runtime_error if the file can't be written */
+	void save(const std::string& path) const;
+
+	/** One line list per link in the namespace of its name */
+	visualization_msgs::MarkerArray toMarkers(const std::string& frame_id) const;
+
+private:
+	std::vector<RefinementRecord, Eigen::aligned_allocator<RefinementRecord>> records_;
+};
+
+/** Makes the report current for the refinement passes of the calling thread until destruction */
+class RefinementReportScope {
+public:
+	explicit RefinementReportScope(RefinementReport* report);
+	~RefinementReportScope();
+
+	static RefinementReport* current();
+
+private:
+	RefinementReport* previous_;
+};
+
+}
+
+#endif //KINEMATICS_TEST_REFINEMENT_REPORT_H
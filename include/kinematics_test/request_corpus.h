@@ -0,0 +1,48 @@
+/*********************************************************************
+ * Planning requests for offline tools. A corpus is a text file with one
+ * move per line:
+ *   <id> <local|global> <x> <y> <z> <roll> <pitch> <yaw> [cartesian|fallback|joint]
+ * Local goals are relative to the end effector at the start state, like
+ * the demo move of the kinematics_test node. The optional path policy
+ * defaults to cartesian. Lines starting with # are ignored.
+ *********************************************************************/
+
+#ifndef KINEMATICS_TEST_REQUEST_CORPUS_H
+#define KINEMATICS_TEST_REQUEST_CORPUS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <Eigen/Geometry>
+#include <kinematics_test/cartesian_path_planner.h>
+
+namespace kinematics_test {
+
+struct PlanningRequest {
+	std::string id;
+	Eigen::Affine3d goal_transform;
+	bool global_reference_frame;
+	PathPolicy path_policy;
+};
+
+struct PlanningResult {
+	std::string id;
+	bool success;
+	size_t waypoint_count;
+	double planning_ms;
+	uint64_t allocated_bytes;
+	int64_t peak_live_bytes;
+	uint64_t peak_rss_bytes;
+};
+
+/** Throws runtime_error if the file can't be read or a line is malformed */
+std::vector<PlanningRequest> loadRequestCorpus(const std::string& path);
+
+/** Results are stored as CSV lines: id,success,waypoint_count,planning_ms,allocated_bytes,peak_live_bytes,
+ * peak_rss_bytes */
+std::string formatResult(const PlanningResult& result);
+bool parseResult(const std::string& line, PlanningResult& result);
+
+}
+
+#endif //KINEMATICS_TEST_REQUEST_CORPUS_H
@@ -0,0 +1,71 @@
+/*********************************************************************
+ * Reproducible IK for the deterministic mode. Every IK call of a request
+ * is keyed by what it solves: the target pose, which is its waypoint or
+ * bisection position on the path, and the joint positions it starts
+ * from. Its restarts start from seeds derived from the request id, the
+ * key and the attempt instead of trac-ik's own randomization, so a
+ * change to one waypoint doesn't move the seeds of the others.
+ *
+ * trac-ik still races KDL against NLopt within an attempt and stops at
+ * a wall-clock timeout, so a solve that is run again may converge to a
+ * different solution. Runs are reproduced bit for bit only by replaying
+ * recorded solutions: a replayed call returns the recorded joint values
+ * without calling the solver.
+ *********************************************************************/
+
+#ifndef KINEMATICS_TEST_REQUEST_SEEDS_H
+#define KINEMATICS_TEST_REQUEST_SEEDS_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include <Eigen/Geometry>
+#include <moveit/robot_model/robot_model.h>
+
+namespace kinematics_test {
+
+class RequestSeeds {
+public:
+	explicit RequestSeeds(const std::string& request_id);
+
+	/** Key of an IK call, a function of its target pose and its starting joint positions only */
+	static uint64_t callKey(const Eigen::Affine3d& pose, const std::vector<double>& start_positions);
+
+	/** Random joint positions within bounds, a function of the request id, the call and the attempt only */
+	void deriveSeed(uint64_t call, size_t attempt, const moveit::core::JointModelGroup* jmg_ptr,
+	                std::vector<double>& seed) const;
+
+	/** Recorded solution of the call, empty for a recorded failure. Return false if the call wasn't recorded.
+	 * The IK calls of one request run on a single thread */
+	bool replay(uint64_t call, std::vector<double>& positions) const;
+	void record(uint64_t call, const std::vector<double>& positions);
+
+	/** Return false if the file can't be read, the recording is left empty then */
+	bool load(const std::string& path);
+	/** Throws runtime_error if the file can't be written */
+	void save(const std::string& path) const;
+
+	const std::string& getRequestId() const { return request_id_; }
+
+private:
+	std::string request_id_;
+	uint64_t request_hash_;
+	std::map<uint64_t, std::vector<double>> recorded_;
+};
+
+/** Makes the seeds current for the IK calls of the calling thread until destruction */
+class SeedRequestScope {
+public:
+	explicit SeedRequestScope(RequestSeeds* seeds);
+	~SeedRequestScope();
+
+	static RequestSeeds* current();
+
+private:
+	RequestSeeds* previous_;
+};
+
+}
+
+#endif //KINEMATICS_TEST_REQUEST_SEEDS_H
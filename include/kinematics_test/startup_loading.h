@@ -0,0 +1,84 @@
+/*********************************************************************
+ * Startup of the planning model and scene. The robot model is parsed
+ * without kinematics solvers. Then the solver of the planning group is
+ * loaded while worker threads build the collision geometry (FCL BVHs)
+ * of the group links into the shape cache of the FCL collision
+ * detector. The scene monitor shares the loader, so the model isn't
+ * parsed again. Its collision robot finds the group links in the cache
+ * and builds only the remaining links itself. Solvers of the other
+ * groups are never loaded.
+ *
+ * Tools planning offline fill the world from a .scene file, the text
+ * format of the MoveIt scene export.
+ *
+ * Every phase goes into an optional startup report with its offset
+ * from the start and its duration, overlapping phases ran in parallel.
+ *********************************************************************/
+
+#ifndef KINEMATICS_TEST_STARTUP_LOADING_H
+#define KINEMATICS_TEST_STARTUP_LOADING_H
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <moveit/kinematics_plugin_loader/kinematics_plugin_loader.h>
+#include <moveit/robot_model_loader/robot_model_loader.h>
+#include <moveit/planning_scene_monitor/planning_scene_monitor.h>
+
+namespace kinematics_test {
+
+struct StartupPhase {
+	std::string name;
+	double start_ms;
+	double duration_ms;
+};
+
+class StartupReport {
+public:
+	StartupReport();
+
+	void add(const std::string& name, std::chrono::steady_clock::time_point start,
+	         std::chrono::steady_clock::time_point end);
+	std::vector<StartupPhase> getPhases() const;
+	//Since the construction of the report
+	double getElapsedMs() const;
+
+	/** One line per phase through rosconsole */
+	void log() const;
+
+private:
+	std::chrono::steady_clock::time_point start_;
+	mutable std::mutex mutex_;
+	std::vector<StartupPhase> phases_;
+};
+
+/** Adds the lifetime of the scope to the report as a phase, nothing without a report */
+class StartupPhaseScope {
+public:
+	StartupPhaseScope(StartupReport* report, const std::string& name);
+	~StartupPhaseScope();
+
+private:
+	StartupReport* report_;
+	std::string name_;
+	std::chrono::steady_clock::time_point start_;
+};
+
+struct PlanningModel {
+	//Its class loaders own the code of the solver, declared first so the model goes before it like in RobotModelLoader
+	kinematics_plugin_loader::KinematicsPluginLoaderPtr kinematics_loader;
+	robot_model_loader::RobotModelLoaderPtr loader;
+	planning_scene_monitor::PlanningSceneMonitorPtr scene_monitor;
+};
+
+/** Load the model, the solver of the group and the scene. Throws runtime_error if the group is unknown */
+PlanningModel loadPlanningModel(const std::string& robot_description, const std::string& planning_group,
+                                StartupReport* report = nullptr);
+
+/** Add the collision objects of a .scene file to the world of the scene. Throws runtime_error if it can't be read */
+void loadSceneGeometry(planning_scene::PlanningScene& scene, const std::string& scene_path);
+
+}
+
+#endif //KINEMATICS_TEST_STARTUP_LOADING_H
@@ -0,0 +1,123 @@
+/*********************************************************************
+ * Low-overhead diagnostics for the hot loops. Every thread writes
+ * fixed-size binary records into its own lock-free ring, a background
+ * thread formats them and forwards them to rosconsole.
+ *********************************************************************/
+
+#ifndef KINEMATICS_TEST_TRACE_LOG_H
+#define KINEMATICS_TEST_TRACE_LOG_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define KT_LOG_LEVEL_DEBUG 0
+#define KT_LOG_LEVEL_INFO 1
+#define KT_LOG_LEVEL_WARN 2
+#define KT_LOG_LEVEL_NONE 3
+
+//Records below this level are removed by the preprocessor
+#ifndef KT_LOG_LEVEL
+#define KT_LOG_LEVEL KT_LOG_LEVEL_INFO
+#endif
+
+#define KT_TRACE_RING_CAPACITY 4096
+#define KT_TRACE_SUBJECT_LENGTH 24
+#define KT_TRACE_FLUSH_PERIOD_MS 5
+
+namespace kinematics_test {
+
+/** Every event knows its own format string, so only the arguments travel through the ring */
+enum TraceEvent : uint8_t {
+	TRACE_LINK_TRANSLATION,
+	TRACE_LINK_BISECTION,
+	TRACE_EVENT_COUNT
+};
+
+struct TraceRecord {
+	uint64_t stamp_ns;
+	uint8_t level;
+	uint8_t event;
+	char subject[KT_TRACE_SUBJECT_LENGTH];
+	double value;
+};
+
+/** Single producer single consumer ring. The owning thread pushes, the flusher pops */
+class TraceRing {
+public:
+	TraceRing();
+
+	//Return false and count the record as dropped when the ring is full
+	bool push(const TraceRecord& record);
+	bool pop(TraceRecord& record);
+
+	std::atomic<bool> in_use;
+	std::atomic<uint64_t> dropped;
+
+private:
+	std::vector<TraceRecord> records_;
+	//Keep producer and consumer indices on separate cache lines
+	char head_padding_[64];
+	std::atomic<size_t> head_;
+	char tail_padding_[64];
+	std::atomic<size_t> tail_;
+};
+
+class TraceLogger {
+public:
+	static TraceLogger& instance();
+
+	void start();
+	//Stop the background thread and flush everything left in the rings
+	void stop();
+
+	void write(uint8_t level, TraceEvent event, const char* subject, double value);
+
+	//Preallocate free rings so new threads don't allocate on their first record
+	void reserveRings(size_t count);
+
+	//Records lost to full rings so far, they are also reported by the flusher
+	uint64_t getDroppedRecords() const;
+
+	~TraceLogger();
+
+private:
+	TraceLogger();
+	TraceRing* acquireRing();
+	void flushLoop();
+	size_t drain();
+
+	std::mutex rings_mutex_;
+	std::vector<std::unique_ptr<TraceRing>> rings_;
+	std::atomic<bool> running_;
+	std::atomic<uint64_t> dropped_records_;
+	std::thread flush_thread_;
+};
+
+}
+
+#if KT_LOG_LEVEL <= KT_LOG_LEVEL_DEBUG
+#define KT_TRACE_DEBUG(event, subject, value) \
+	kinematics_test::TraceLogger::instance().write(KT_LOG_LEVEL_DEBUG, event, subject, value)
+#else
+#define KT_TRACE_DEBUG(event, subject, value) do {} while (0)
+#endif
+
+#if KT_LOG_LEVEL <= KT_LOG_LEVEL_INFO
+#define KT_TRACE_INFO(event, subject, value) \
+	kinematics_test::TraceLogger::instance().write(KT_LOG_LEVEL_INFO, event, subject, value)
+#else
+#define KT_TRACE_INFO(event, subject, value) do {} while (0)
+#endif
+
+#if KT_LOG_LEVEL <= KT_LOG_LEVEL_WARN
+#define KT_TRACE_WARN(event, subject, value) \
+	kinematics_test::TraceLogger::instance().write(KT_LOG_LEVEL_WARN, event, subject, value)
+#else
+#define KT_TRACE_WARN(event, subject, value) do {} while (0)
+#endif
+
+#endif //KINEMATICS_TEST_TRACE_LOG_H
@@ -0,0 +1,81 @@
+/*********************************************************************
+ * Path quality metrics computed in one pass before a trajectory leaves
+ * the planner. The joint positions and the forward kinematics of the
+ * refined links are gathered into column buffers once, every metric is
+ * then an Eigen array expression over those buffers.
+ *
+ * Rates are taken along the nominal tool motion: a segment lasts as long
+ * as the end effector needs at tool_speed and tool_angular_speed. A
+ * violated joint limit means the path can't be followed at that speed.
+ *********************************************************************/
+
+#ifndef KINEMATICS_TEST_TRAJECTORY_ANALYTICS_H
+#define KINEMATICS_TEST_TRAJECTORY_ANALYTICS_H
+
+#include <list>
+#include <string>
+#include <vector>
+#include <Eigen/Dense>
+#include <moveit/robot_model/robot_model.h>
+#include <moveit/robot_state/robot_state.h>
+#include <kinematics_test/link_transform_table.h>
+
+//Metrics above their limit by less than this are rounding, not violations
+#define ANALYTICS_TOLERANCE 1e-9
+
+namespace kinematics_test {
+
+struct TrajectoryMetrics {
+	size_t waypoint_count;
+	//Execution time at the nominal tool speed
+	double duration;
+	//Peak absolute rates per joint of the planning group
+	Eigen::VectorXd peak_velocity;
+	Eigen::VectorXd peak_acceleration;
+	Eigen::VectorXd peak_jerk;
+	//Greatest distance of the end effector from the straight line between the ends of the trail
+	double cartesian_deviation;
+	//Greatest getFullTranslation between neighbouring waypoints per refined link
+	Eigen::VectorXd link_swept_distance;
+	//Empty if the trajectory respects every limit
+	std::string violation;
+};
+
+struct AnalyticsLimits {
+	double tool_speed;
+	double tool_angular_speed;
+	//Zero leaves the metric unchecked
+	double max_joint_jerk;
+	double max_cartesian_deviation;
+	double max_swept_distance;
+};
+
+class TrajectoryAnalyzer {
+public:
+	/** Velocity and acceleration limits come from the bounds of the robot model */
+	TrajectoryAnalyzer(const robot_model::RobotModelConstPtr& kinematic_model, const std::string& planning_group,
+	                   const std::string& end_effector, const std::vector<const robot_state::LinkModel*>& links,
+	                   const AnalyticsLimits& limits);
+
+	/** Fill the metrics and the first violated limit. The deviation is only checked for straight tool paths.
+	 * Transforms come from the table of the current LinkTransformScope when it holds every link */
+	void analyze(const std::list<robot_state::RobotStatePtr>& trail, bool straight_path,
+	             TrajectoryMetrics& metrics) const;
+
+	const std::vector<const robot_state::LinkModel*>& getLinks() const { return links_; }
+	const std::vector<std::string>& getJointNames() const;
+
+private:
+	const robot_state::JointModelGroup* jmg_ptr_;
+	const robot_state::LinkModel* end_effector_;
+	std::vector<const robot_state::LinkModel*> links_;
+	//Diagonal of the extents of every link, the lever arm of getFullTranslation
+	Eigen::VectorXd link_diagonals_;
+	Eigen::VectorXd max_velocity_;
+	Eigen::VectorXd max_acceleration_;
+	AnalyticsLimits limits_;
+};
+
+}
+
+#endif //KINEMATICS_TEST_TRAJECTORY_ANALYTICS_H
@@ -0,0 +1,74 @@
+/*********************************************************************
+ * Shared-memory ring of validated joint trajectories. The planner
+ * writes the timed waypoints straight into the segment, a local
+ * controller process reads them in place without any serialization.
+ * A slot holds the times from start, then the positions, velocities and
+ * accelerations, each array sized for the maximum waypoint count.
+ *********************************************************************/
+
+#ifndef KINEMATICS_TEST_TRAJECTORY_SHM_TRANSPORT_H
+#define KINEMATICS_TEST_TRAJECTORY_SHM_TRANSPORT_H
+
+#include <cstdint>
+#include <string>
+#include <kinematics_test/cartesian_path_planner.h>
+
+#define SHM_TRAJECTORY_SLOTS 4
+#define SHM_TRAJECTORY_MAX_WAYPOINTS 20000
+
+namespace kinematics_test {
+
+struct ShmRingHeader;
+struct ShmSlotHeader;
+
+class TrajectoryShmRing {
+public:
+	/** Consumer view into a slot. The arrays stay in shared memory, the joint values row-major by waypoint */
+	struct View {
+		uint64_t sequence;
+		size_t waypoint_count;
+		size_t joint_count;
+		//Seconds from the start of the trajectory
+		const double* times;
+		const double* positions;
+		const double* velocities;
+		const double* accelerations;
+	};
+
+	//Producer side: create or resize the segment. Throws runtime_error on failure
+	TrajectoryShmRing(const std::string& name, size_t slot_count, size_t max_waypoints, size_t joint_count);
+	//Consumer side: attach to a segment created by the producer. Throws runtime_error on failure
+	explicit TrajectoryShmRing(const std::string& name);
+	~TrajectoryShmRing();
+
+	TrajectoryShmRing(const TrajectoryShmRing&) = delete;
+	TrajectoryShmRing& operator=(const TrajectoryShmRing&) = delete;
+
+	size_t getJointCount() const;
+
+	/** Publish the timed waypoints of the trajectory. Return false if it doesn't fit into a slot */
+	bool write(const robot_trajectory::RobotTrajectory& trajectory, const robot_state::JointModelGroup* jmg_ptr);
+
+	/** Point the view at the newest complete trajectory. Return false if there is none yet */
+	bool latest(View& view) const;
+
+	/** The producer reuses slots, so a consumer must check the view after using the positions */
+	bool isValid(const View& view) const;
+
+private:
+	ShmSlotHeader* slot(uint64_t sequence) const;
+	//Offset in doubles of an array behind the slot header: 0 times, 1 positions, 2 velocities, 3 accelerations
+	size_t arrayOffset(size_t array_idx) const;
+	void map(bool create);
+
+	std::string name_;
+	size_t segment_size_;
+	size_t slot_stride_;
+	bool owner_;
+	void* segment_;
+	ShmRingHeader* header_;
+};
+
+}
+
+#endif //KINEMATICS_TEST_TRAJECTORY_SHM_TRANSPORT_H
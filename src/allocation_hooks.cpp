@@ -0,0 +1,68 @@
+/*********************************************************************
+ * Global operator new/delete counting the allocations of planning
+ * requests, see memory_accounting.h. Compiled into the executables that
+ * report request memory, never into a library: a replacement there
+ * would hook every binary and nodelet loaded with it.
+ *********************************************************************/
+
+#include <kinematics_test/memory_accounting.h>
+
+#include <cstdlib>
+#include <new>
+
+using kinematics_test::accountAllocation;
+using kinematics_test::accountFree;
+
+static const bool hooks_installed = (kinematics_test::installAllocationAccounting(), true);
+
+static void* accountedAllocate(size_t size){
+	void* ptr = malloc(size ? size : 1);
+	if (ptr)
+		accountAllocation(ptr);
+	return ptr;
+}
+
+static void accountedFree(void* ptr){
+	if (!ptr)
+		return;
+	accountFree(ptr);
+	free(ptr);
+}
+
+void* operator new(size_t size){
+	void* ptr = accountedAllocate(size);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new[](size_t size){
+	void* ptr = accountedAllocate(size);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept{
+	return accountedAllocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept{
+	return accountedAllocate(size);
+}
+
+void operator delete(void* ptr) noexcept{
+	accountedFree(ptr);
+}
+
+void operator delete[](void* ptr) noexcept{
+	accountedFree(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept{
+	accountedFree(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept{
+	accountedFree(ptr);
+}
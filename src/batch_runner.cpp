@@ -0,0 +1,447 @@
+/*********************************************************************
+ * Offline validation of a request corpus. Requests are sharded across
+ * worker processes; every worker checkpoints its results, so a crashed
+ * worker is restarted and resumes where it stopped. Several hosts split
+ * the corpus with --shard and the result directories are merged with
+ * --merge.
+ *
+ *   batch_runner <corpus> <output_dir> [--workers N] [--shard K/N] [--seed-model path] [--perf]
+ *                [--record-seeds dir] [--replay-seeds dir] [--library] [--explain dir] [--scene file]
+ *   batch_runner --merge <output_dir>
+ *   batch_runner --validate-library <output_dir>
+ *
+ * Workers read the planner parameters of the batch_runner namespace
+ * (e.g. rosparam load planner.yaml batch_runner), the command line
+ * options take precedence. --validate-library reads the same namespace.
+ * --scene loads the world of the cell from a .scene file, without it
+ * only self collisions are checked.
+ *
+ * --perf prints hardware counters per pipeline stage for every worker.
+ * Both seed options turn on the deterministic mode. --record-seeds saves
+ * the IK solutions of every request to <dir>/<id>.seeds, --replay-seeds
+ * reuses them so a run can be reproduced bit for bit. Without a replay
+ * the seeds are fixed but trac-ik's timeout is not, results may differ.
+ *
+ * --library stores every valid trajectory as float32 joint positions in
+ * shard_*.trajectories. --validate-library checks the swept distance of
+ * a stored library with the float32 kernels against the configured
+ * distance_constraint, segments near the limit again in double. With
+ * padded_collision or clearance_factor it reports the peak only.
+ *
+ * --explain writes the refinement report of every request to
+ * <dir>/<id>.csv: the swept distance and the bisections of every link
+ * and segment.
+ * Every result records the bytes allocated by the request, its peak live
+ * heap and the resident set high-water mark of the worker.
+ *********************************************************************/
+
+#include <ros/ros.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <set>
+#include <thread>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <moveit/robot_model_loader/robot_model_loader.h>
+#include <moveit/planning_scene/planning_scene.h>
+#include <kinematics_test/cartesian_path_planner.h>
+#include <kinematics_test/compact_trajectory.h>
+#include <kinematics_test/perf_counters.h>
+#include <kinematics_test/request_corpus.h>
+#include <kinematics_test/startup_loading.h>
+
+#define DEFAULT_ROBOT_DESCRIPTION "robot_description"
+#define MAX_WORKER_RESTARTS 3
+//Exit code of a worker that can't start, it would fail again after a restart
+#define WORKER_SETUP_FAILED 2
+//Workers and the validation run under anonymous node names, the parameters live in this fixed namespace
+#define PARAMETER_NAMESPACE "batch_runner"
+
+using namespace std;
+using namespace moveit;
+using namespace core;
+using namespace kinematics_test;
+
+struct WorkerOptions {
+	string seed_record_dir;
+	string seed_replay_dir;
+	bool store_library;
+	string explain_dir;
+	string scene_path;
+};
+
+/** Ids already finished by a previous run of the worker */
+set<string> readCheckpoint(const string& checkpoint_path){
+	set<string> finished;
+	ifstream checkpoint(checkpoint_path.c_str());
+	string line;
+	PlanningResult result;
+	while (getline(checkpoint, line))
+		if (parseResult(line, result))
+			finished.insert(result.id);
+	return finished;
+}
+
+string libraryPath(const string& checkpoint_path){
+	return checkpoint_path.substr(0, checkpoint_path.size() - 4) + ".trajectories";
+}
+
+int runWorker(const vector<PlanningRequest>& requests, const vector<size_t>& request_indices,
+              const string& checkpoint_path, const PlannerConfig& config, const WorkerOptions& worker_options,
+              int argc, char** argv){
+
+	set<string> finished = readCheckpoint(checkpoint_path);
+	ofstream checkpoint(checkpoint_path.c_str(), ios::app);
+	ofstream library;
+	if (worker_options.store_library)
+		library.open(libraryPath(checkpoint_path).c_str(), ios::app | ios::binary);
+
+	//The request that was running when the previous worker died is not retried, it would crash again
+	string inflight_path = checkpoint_path + ".inflight";
+	ifstream inflight(inflight_path.c_str());
+	string crashed_id;
+	if (getline(inflight, crashed_id) && !finished.count(crashed_id)){
+		PlanningResult crashed = {crashed_id, false, 0, 0.0, 0, 0, 0};
+		checkpoint << formatResult(crashed) << endl;
+		finished.insert(crashed_id);
+		fprintf(stderr, "Request %s crashed the previous worker, recorded as failed\n", crashed_id.c_str());
+	}
+
+	ros::init(argc, argv, "batch_runner_worker", ros::init_options::AnonymousName | ros::init_options::NoSigintHandler);
+	ros::NodeHandle node_handle;
+
+	robot_model_loader::RobotModelLoader kt_robot_model_loader(DEFAULT_ROBOT_DESCRIPTION);
+	robot_model::RobotModelConstPtr kt_kinematic_model = kt_robot_model_loader.getModel();
+	planning_scene::PlanningScenePtr kt_planning_scene(new planning_scene::PlanningScene(kt_kinematic_model));
+	PlannerConfig worker_config = config;
+	try {
+		loadPlannerConfig(ros::NodeHandle(PARAMETER_NAMESPACE), worker_config);
+		if (!worker_options.scene_path.empty())
+			loadSceneGeometry(*kt_planning_scene, worker_options.scene_path);
+	}
+	catch (const runtime_error& error){
+		fprintf(stderr, "%s\n", error.what());
+		return WORKER_SETUP_FAILED;
+	}
+	//The seed options of the command line win over the parameters
+	if (config.seed_predictor)
+		worker_config.seed_predictor = config.seed_predictor;
+	worker_config.deterministic = worker_config.deterministic || config.deterministic;
+	CartesianPathPlanner planner(kt_kinematic_model, kt_planning_scene, worker_config);
+
+	robot_state::RobotState start_state(kt_kinematic_model);
+	setToStartState(start_state, planner.getConfig());
+	planner.warmUp(start_state);
+	PerfCounters::reset();
+	const robot_state::JointModelGroup* jmg_ptr = kt_kinematic_model->getJointModelGroup(
+			worker_config.planning_group);
+
+	for (size_t request_idx : request_indices){
+		const PlanningRequest& request = requests[request_idx];
+		if (finished.count(request.id))
+			continue;
+		ofstream(inflight_path.c_str(), ios::trunc) << request.id << endl;
+
+		RequestSeeds seeds(request.id);
+		if (!worker_options.seed_replay_dir.empty() && !seeds.load(worker_options.seed_replay_dir + "/" + request.id + ".seeds"))
+			fprintf(stderr, "No recorded seeds for %s, solving it fresh\n", request.id.c_str());
+
+		Trail trail;
+		RequestMemory memory(worker_config.memory_budget_bytes);
+		RefinementReport explain_report;
+		chrono::steady_clock::time_point plan_start = chrono::steady_clock::now();
+		bool is_planned;
+		{
+			SeedRequestScope seed_scope(&seeds);
+			RefinementReportScope report_scope(worker_options.explain_dir.empty() ? nullptr : &explain_report);
+			is_planned = planner.plan(trail, start_state, request.goal_transform, request.global_reference_frame,
+			                          request.path_policy, &memory);
+		}
+		chrono::steady_clock::time_point plan_end = chrono::steady_clock::now();
+		//A file that can't be written loses its output only, the result is still recorded
+		try {
+			if (!worker_options.seed_record_dir.empty())
+				seeds.save(worker_options.seed_record_dir + "/" + request.id + ".seeds");
+			if (!worker_options.explain_dir.empty())
+				explain_report.save(worker_options.explain_dir + "/" + request.id + ".csv");
+		}
+		catch (const runtime_error& error){
+			fprintf(stderr, "%s\n", error.what());
+		}
+
+		PlanningResult result = {request.id, is_planned, trail.size(),
+		                         chrono::duration<double, milli>(plan_end - plan_start).count(),
+		                         memory.allocated_bytes.load(), memory.peak_live_bytes.load(), memory.peak_rss_bytes};
+		//The trajectory goes first, a request replanned after a crash may be stored twice
+		if (library.is_open() && is_planned)
+			writeCompactTrajectory(library, compactTrail<float>(trail, jmg_ptr, request.id));
+		library.flush();
+		checkpoint << formatResult(result) << endl;
+	}
+	remove(inflight_path.c_str());
+	if (worker_config.seed_predictor)
+		worker_config.seed_predictor->report();
+	if (PerfCounters::isEnabled())
+		PerfCounters::report();
+	return 0;
+}
+
+string checkpointPath(const string& output_dir, size_t shard_index, size_t worker_idx){
+	return output_dir + "/shard_" + to_string(shard_index) + "_" + to_string(worker_idx) + ".csv";
+}
+
+/** Files of the output directory named shard_*<suffix> */
+vector<string> listShardFiles(const string& output_dir, const string& suffix){
+	vector<string> paths;
+	DIR* directory = opendir(output_dir.c_str());
+	if (!directory)
+		return paths;
+	while (dirent* entry = readdir(directory)){
+		string file_name = entry->d_name;
+		if (file_name.compare(0, 6, "shard_") == 0 && file_name.size() >= suffix.size() &&
+				file_name.compare(file_name.size() - suffix.size(), suffix.size(), suffix) == 0)
+			paths.push_back(output_dir + "/" + file_name);
+	}
+	closedir(directory);
+	sort(paths.begin(), paths.end());
+	return paths;
+}
+
+/** ROS is not fork-safe, so only the child initializes it */
+pid_t spawnWorker(const vector<PlanningRequest>& requests, const vector<size_t>& request_indices,
+                  const string& checkpoint_path, const PlannerConfig& config, const WorkerOptions& worker_options,
+                  int argc, char** argv){
+	pid_t pid = fork();
+	if (pid == 0){
+		int status = runWorker(requests, request_indices, checkpoint_path, config, worker_options, argc, argv);
+		//_exit skips the stdio buffers, the reports would be lost when stdout is a pipe or a file
+		fflush(nullptr);
+		_exit(status);
+	}
+	return pid;
+}
+
+/** Collect every shard_*.csv of the directory into results.csv and print the timing report */
+int mergeResults(const string& output_dir){
+	map<string, PlanningResult> results;
+	for (const string& shard_path : listShardFiles(output_dir, ".csv")){
+		ifstream shard(shard_path.c_str());
+		string line;
+		PlanningResult result;
+		while (getline(shard, line))
+			if (parseResult(line, result))
+				results[result.id] = result;
+	}
+
+	ofstream merged((output_dir + "/results.csv").c_str());
+	vector<double> latencies;
+	size_t succeeded = 0, waypoints = 0;
+	uint64_t allocated_bytes = 0, peak_rss_bytes = 0;
+	int64_t peak_live_bytes = 0;
+	for (const pair<const string, PlanningResult>& entry : results){
+		merged << formatResult(entry.second) << endl;
+		latencies.push_back(entry.second.planning_ms);
+		succeeded += entry.second.success;
+		waypoints += entry.second.waypoint_count;
+		allocated_bytes += entry.second.allocated_bytes;
+		peak_live_bytes = max(peak_live_bytes, entry.second.peak_live_bytes);
+		peak_rss_bytes = max(peak_rss_bytes, entry.second.peak_rss_bytes);
+	}
+	if (latencies.empty()){
+		printf("No results in %s\n", output_dir.c_str());
+		return 0;
+	}
+
+	sort(latencies.begin(), latencies.end());
+	double total_ms = 0;
+	for (double latency : latencies)
+		total_ms += latency;
+	printf("Requests: %lu, succeeded: %lu, waypoints: %lu\n", results.size(), succeeded, waypoints);
+	printf("Planning time, ms: total %.1f, mean %.3f, p50 %.3f, p95 %.3f, max %.3f\n", total_ms,
+	       total_ms / latencies.size(), latencies[latencies.size() / 2],
+	       latencies[min(latencies.size() - 1, latencies.size() * 95 / 100)], latencies.back());
+	printf("Memory, MB: allocated per request %.2f, peak live %.2f, peak RSS %.1f\n",
+	       allocated_bytes / 1048576.0 / results.size(), peak_live_bytes / 1048576.0, peak_rss_bytes / 1048576.0);
+	return 0;
+}
+
+/** Swept distance check of every stored trajectory with the float32 kernels. Padded and clearance adaptive
+ * trajectories legitimately sweep more than the distance constraint, only their peak is reported */
+int validateLibrary(const string& output_dir, int argc, char** argv){
+	ros::init(argc, argv, "batch_runner_validation", ros::init_options::AnonymousName);
+	ros::NodeHandle node_handle;
+	PlannerConfig config;
+	loadPlannerConfig(ros::NodeHandle(PARAMETER_NAMESPACE), config);
+	robot_model_loader::RobotModelLoader kt_robot_model_loader(DEFAULT_ROBOT_DESCRIPTION);
+	robot_model::RobotModelConstPtr kt_kinematic_model = kt_robot_model_loader.getModel();
+	ChainKinematics chain(kt_kinematic_model->getJointModelGroup(config.planning_group),
+	                      getRefinedLinks(kt_kinematic_model));
+	//Same rule as the analytics stage
+	bool swept_verdict = !config.padded_collision && config.clearance_factor <= 0;
+	double limit = swept_verdict ? config.distance_constraint : numeric_limits<double>::infinity();
+	if (!swept_verdict)
+		ROS_INFO("Trajectories aren't refined to the distance constraint, reporting swept distances only");
+
+	size_t trajectories = 0, waypoints = 0, stored_bytes = 0, invalid_trajectories = 0;
+	SweptVerification total = {0, 0, 0, 0.0};
+	set<string> validated_ids;
+	chrono::steady_clock::time_point validation_start = chrono::steady_clock::now();
+	for (const string& library_path : listShardFiles(output_dir, ".trajectories")){
+		ifstream library(library_path.c_str(), ios::binary);
+		CompactTrajectory<float> trajectory;
+		while (readCompactTrajectory(library, trajectory)){
+			if (!validated_ids.insert(trajectory.id).second)
+				continue;
+			SweptVerification verification = chain.verifySweptDistances(trajectory, limit);
+			if (verification.violations){
+				ROS_ERROR("%s: %lu segments over the distance constraint, peak %.6f m", trajectory.id.c_str(),
+				          verification.violations, verification.peak_swept_distance);
+				invalid_trajectories++;
+			}
+			trajectories++;
+			waypoints += trajectory.size();
+			stored_bytes += trajectory.positions.size() * sizeof(float);
+			total.segments += verification.segments;
+			total.verified_segments += verification.verified_segments;
+			total.violations += verification.violations;
+			total.peak_swept_distance = max(total.peak_swept_distance, verification.peak_swept_distance);
+		}
+	}
+	double validation_s = chrono::duration<double>(chrono::steady_clock::now() - validation_start).count();
+
+	printf("Trajectories: %lu, invalid: %lu, waypoints: %lu, joint data %.2f MB (%.2f MB as double)\n",
+	       trajectories, invalid_trajectories, waypoints, stored_bytes / 1048576.0, 2 * stored_bytes / 1048576.0);
+	printf("Segments: %lu, verified in double: %lu, violations: %lu, peak swept %.6f m, error bound %.2e m\n",
+	       total.segments, total.verified_segments, total.violations, total.peak_swept_distance,
+	       chain.sweptErrorBound<float>());
+	printf("Validation: %.2f s, %.0f waypoints/s\n", validation_s, validation_s > 0 ? waypoints / validation_s : 0.0);
+	return invalid_trajectories ? 1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc >= 3 && string(argv[1]) == "--merge")
+		return mergeResults(argv[2]);
+	if (argc >= 3 && string(argv[1]) == "--validate-library")
+		return validateLibrary(argv[2], argc, argv);
+	if (argc < 3){
+		fprintf(stderr, "Usage: batch_runner <corpus> <output_dir> [--workers N] [--shard K/N] [--seed-model path] [--perf]\n"
+		                "                    [--record-seeds dir] [--replay-seeds dir] [--library] [--explain dir]\n"
+		                "                    [--scene file]\n"
+		                "       batch_runner --merge <output_dir>\n"
+		                "       batch_runner --validate-library <output_dir>\n");
+		return 1;
+	}
+
+	string corpus_path = argv[1];
+	string output_dir = argv[2];
+	size_t worker_count = max(1u, thread::hardware_concurrency());
+	size_t shard_index = 0, shard_count = 1;
+	PlannerConfig config;
+	WorkerOptions worker_options = {"", "", false, "", ""};
+	for (int arg_idx = 3; arg_idx < argc; arg_idx += 2){
+		string option = argv[arg_idx];
+		if (option == "--perf"){
+			PerfCounters::enable();
+			arg_idx--;
+			continue;
+		}
+		if (option == "--library"){
+			worker_options.store_library = true;
+			arg_idx--;
+			continue;
+		}
+		if (arg_idx + 1 == argc){
+			fprintf(stderr, "Option %s needs a value\n", argv[arg_idx]);
+			return 1;
+		}
+		if (option == "--workers")
+			worker_count = max(1, atoi(argv[arg_idx + 1]));
+		else if (option == "--shard"){
+			if (sscanf(argv[arg_idx + 1], "%lu/%lu", &shard_index, &shard_count) != 2 || shard_index >= shard_count){
+				fprintf(stderr, "Bad shard %s, expected K/N with K < N\n", argv[arg_idx + 1]);
+				return 1;
+			}
+		}
+		else if (option == "--seed-model")
+			config.seed_predictor.reset(new IkSeedPredictor(argv[arg_idx + 1]));
+		else if (option == "--record-seeds"){
+			worker_options.seed_record_dir = argv[arg_idx + 1];
+			config.deterministic = true;
+		}
+		else if (option == "--explain")
+			worker_options.explain_dir = argv[arg_idx + 1];
+		else if (option == "--scene")
+			worker_options.scene_path = argv[arg_idx + 1];
+		else if (option == "--replay-seeds"){
+			worker_options.seed_replay_dir = argv[arg_idx + 1];
+			config.deterministic = true;
+		}
+		else {
+			fprintf(stderr, "Unknown option %s %s\n", argv[arg_idx], argv[arg_idx + 1]);
+			return 1;
+		}
+	}
+
+	vector<PlanningRequest> requests = loadRequestCorpus(corpus_path);
+	if (worker_options.scene_path.empty())
+		fprintf(stderr, "No --scene given, the requests are only checked for self collisions\n");
+	mkdir(output_dir.c_str(), 0755);
+	if (!worker_options.seed_record_dir.empty())
+		mkdir(worker_options.seed_record_dir.c_str(), 0755);
+	if (!worker_options.explain_dir.empty())
+		mkdir(worker_options.explain_dir.c_str(), 0755);
+
+	//Host shard first, then round-robin over the local workers
+	vector<vector<size_t>> worker_requests(worker_count);
+	size_t shard_position = 0;
+	for (size_t request_idx = shard_index; request_idx < requests.size(); request_idx += shard_count)
+		worker_requests[shard_position++ % worker_count].push_back(request_idx);
+
+	map<pid_t, size_t> running_workers;
+	vector<size_t> restarts(worker_count, 0);
+	chrono::steady_clock::time_point batch_start = chrono::steady_clock::now();
+
+	for (size_t worker_idx = 0; worker_idx < worker_count; ++worker_idx)
+		if (!worker_requests[worker_idx].empty())
+			running_workers[spawnWorker(requests, worker_requests[worker_idx],
+			                            checkpointPath(output_dir, shard_index, worker_idx), config, worker_options,
+			                            argc, argv)] = worker_idx;
+
+	while (!running_workers.empty()){
+		int status;
+		pid_t pid = wait(&status);
+		if (pid < 0)
+			break;
+		size_t worker_idx = running_workers[pid];
+		running_workers.erase(pid);
+
+		if (WIFEXITED(status) && WEXITSTATUS(status) == WORKER_SETUP_FAILED){
+			fprintf(stderr, "Worker %lu couldn't start, its requests are skipped\n", worker_idx);
+			continue;
+		}
+		bool crashed = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+		if (crashed && restarts[worker_idx] < MAX_WORKER_RESTARTS){
+			restarts[worker_idx]++;
+			fprintf(stderr, "Worker %lu crashed, resuming from checkpoint\n", worker_idx);
+			running_workers[spawnWorker(requests, worker_requests[worker_idx],
+			                            checkpointPath(output_dir, shard_index, worker_idx), config, worker_options,
+			                            argc, argv)] = worker_idx;
+		}
+		else if (crashed)
+			fprintf(stderr, "Worker %lu crashed %d times, its remaining requests are skipped\n",
+			        worker_idx, MAX_WORKER_RESTARTS + 1);
+	}
+
+	chrono::steady_clock::time_point batch_end = chrono::steady_clock::now();
+	printf("Shard %lu/%lu finished in %.1f s\n", shard_index, shard_count,
+	       chrono::duration<double>(batch_end - batch_start).count());
+	return mergeResults(output_dir);
+}
@@ -0,0 +1,826 @@
+#include <kinematics_test/cartesian_path_planner.h>
+#include <kinematics_test/controller_resampling.h>
+#include <kinematics_test/perf_counters.h>
+#include <kinematics_test/trace_log.h>
+
+#include <ros/ros.h>
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <future>
+#include <map>
+#include <thread>
+#include <geometric_shapes/shape_operations.h>
+#include <tf2_eigen/tf2_eigen.h>
+
+using namespace std;
+using namespace moveit;
+using namespace core;
+
+namespace kinematics_test {
+
+PlannerConfig::PlannerConfig() :
+		planning_group(PLANNING_GROUP),
+		end_effector(FANUC_M20IA_END_EFFECTOR),
+		interpolation_step(STANDARD_INTERPOLATION_STEP),
+		distance_constraint(EXPERIMENTAL_DISTANCE_CONSTRAINT),
+		attempt_number(EXPERIMENTAL_ATTEMPT_NUMBER),
+		ik_timeout(DEFAULT_IK_TIMEOUT),
+		warm_up_iterations(WARM_UP_ITERATIONS),
+		seeded_ik_timeout(SEEDED_IK_TIMEOUT),
+		memory_budget_bytes(0),
+		deterministic(false),
+		tool_speed(0.0),
+		tool_angular_speed(NOMINAL_TOOL_ANGULAR_SPEED),
+		max_joint_jerk(0.0),
+		max_cartesian_deviation(0.0),
+		padded_collision(false),
+		clearance_factor(0.0),
+		controller_rate(0.0){}
+
+void loadPlannerConfig(const ros::NodeHandle& node_handle, PlannerConfig& config){
+	int attempt_number = config.attempt_number;
+	int warm_up_iterations = config.warm_up_iterations;
+	double memory_budget_mb = config.memory_budget_bytes / 1048576.0;
+	string seed_model_path;
+
+	node_handle.getParam("interpolation_step", config.interpolation_step);
+	node_handle.getParam("distance_constraint", config.distance_constraint);
+	node_handle.getParam("attempt_number", attempt_number);
+	node_handle.getParam("ik_timeout", config.ik_timeout);
+	node_handle.getParam("planning_group", config.planning_group);
+	node_handle.getParam("end_effector", config.end_effector);
+	node_handle.getParam("warm_up_iterations", warm_up_iterations);
+	if (node_handle.getParam("seed_model", seed_model_path))
+		config.seed_predictor.reset(new IkSeedPredictor(seed_model_path));
+	node_handle.getParam("memory_budget_mb", memory_budget_mb);
+	node_handle.getParam("deterministic", config.deterministic);
+	node_handle.getParam("tool_speed", config.tool_speed);
+	node_handle.getParam("tool_angular_speed", config.tool_angular_speed);
+	node_handle.getParam("max_joint_jerk", config.max_joint_jerk);
+	node_handle.getParam("max_cartesian_deviation", config.max_cartesian_deviation);
+	node_handle.getParam("padded_collision", config.padded_collision);
+	node_handle.getParam("clearance_factor", config.clearance_factor);
+	node_handle.getParam("controller_rate", config.controller_rate);
+
+	//Checked before the conversion, a negative count would wrap around
+	if (attempt_number < 2 || warm_up_iterations < 0 || memory_budget_mb < 0)
+		throw runtime_error("Invalid planner parameters in " + node_handle.getNamespace());
+	config.attempt_number = attempt_number;
+	config.warm_up_iterations = warm_up_iterations;
+	config.memory_budget_bytes = memory_budget_mb * 1048576.0;
+	validatePlannerConfig(config, node_handle.getNamespace());
+}
+
+void validatePlannerConfig(const PlannerConfig& config, const string& source){
+	if (config.interpolation_step <= 0 || config.distance_constraint <= 0 || config.attempt_number < 2 ||
+			config.ik_timeout < 0 || config.tool_speed < 0 || config.tool_angular_speed <= 0 ||
+			config.max_joint_jerk < 0 || config.max_cartesian_deviation < 0 || config.clearance_factor < 0 ||
+			config.clearance_factor > 1 || config.controller_rate < 0)
+		throw runtime_error("Invalid planner parameters in " + source);
+}
+
+bool parsePathPolicy(const string& name, PathPolicy& policy){
+	if (name == "cartesian")
+		policy = PATH_CARTESIAN;
+	else if (name == "fallback")
+		policy = PATH_JOINT_FALLBACK;
+	else if (name == "joint")
+		policy = PATH_JOINT;
+	else
+		return false;
+	return true;
+}
+
+const char* pathPolicyName(PathPolicy policy){
+	switch (policy){
+		case PATH_CARTESIAN:
+			return "cartesian";
+		case PATH_JOINT_FALLBACK:
+			return "fallback";
+		case PATH_JOINT:
+			return "joint";
+		default:
+			return "unknown";
+	}
+}
+
+/** setFromIK without trac-ik's own restarts in deterministic mode. A recorded solution is returned as is, otherwise
+ * the first attempt starts from the current state and the others from seeds derived from the request and the call.
+ * The call is keyed by the pose and the current state, the order of the calls doesn't matter */
+static bool solveIK(robot_state::RobotState& kinematic_state, const robot_state::JointModelGroup* jmg_ptr,
+                    const robot_state::LinkModel* tip, const Eigen::Affine3d& pose, const PlannerConfig& config){
+
+	RequestSeeds* seeds = SeedRequestScope::current();
+	if (!config.deterministic || !seeds)
+		return kinematic_state.setFromIK(jmg_ptr, pose, tip->getName(), 0, config.ik_timeout);
+
+	vector<double> positions;
+	kinematic_state.copyJointGroupPositions(jmg_ptr, positions);
+	uint64_t call = RequestSeeds::callKey(pose, positions);
+	vector<double> recorded_positions;
+	if (seeds->replay(call, recorded_positions)){
+		if (recorded_positions.empty())
+			return false;
+		kinematic_state.setJointGroupPositions(jmg_ptr, recorded_positions);
+		kinematic_state.update();
+		return true;
+	}
+
+	for (size_t attempt = 0; attempt < DETERMINISTIC_IK_ATTEMPTS; ++attempt){
+		if (attempt > 0)
+			seeds->deriveSeed(call, attempt, jmg_ptr, positions);
+		kinematic_state.setJointGroupPositions(jmg_ptr, positions);
+		if (kinematic_state.setFromIK(jmg_ptr, pose, tip->getName(), 1, config.ik_timeout)){
+			kinematic_state.copyJointGroupPositions(jmg_ptr, positions);
+			seeds->record(call, positions);
+			return true;
+		}
+	}
+	seeds->record(call, vector<double>());
+	return false;
+}
+
+/** trac-ik from the learned seed first, then from the previous waypoint as without the predictor. In deterministic
+ * mode the prediction is only the starting point of the first attempt, a timeout must not change the result */
+static bool solveStepIK(robot_state::RobotState& kinematic_state, const robot_state::JointModelGroup* jmg_ptr,
+                        const robot_state::LinkModel* tip, const Eigen::Affine3d& pose, const PlannerConfig& config){
+
+	const IkSeedPredictor* predictor = config.seed_predictor.get();
+	if (!predictor || jmg_ptr->getVariableCount() != SEED_PREDICTOR_JOINTS)
+		return solveIK(kinematic_state, jmg_ptr, tip, pose, config);
+
+	chrono::steady_clock::time_point ik_start = chrono::steady_clock::now();
+	double previous_positions[SEED_PREDICTOR_JOINTS];
+	double seed[SEED_PREDICTOR_JOINTS];
+	kinematic_state.copyJointGroupPositions(jmg_ptr, previous_positions);
+	predictor->predict(kinematic_state.getGlobalLinkTransform(tip), pose, previous_positions, seed);
+	kinematic_state.setJointGroupPositions(jmg_ptr, seed);
+	kinematic_state.enforceBounds(jmg_ptr);
+	if (config.deterministic)
+		return solveIK(kinematic_state, jmg_ptr, tip, pose, config);
+
+	predictor->statistics.seeded_attempts++;
+	bool found_ik = kinematic_state.setFromIK(jmg_ptr, pose, tip->getName(), 1, config.seeded_ik_timeout);
+	if (found_ik)
+		predictor->statistics.seeded_successes++;
+	else {
+		kinematic_state.setJointGroupPositions(jmg_ptr, previous_positions);
+		predictor->statistics.fallback_attempts++;
+		found_ik = kinematic_state.setFromIK(jmg_ptr, pose, tip->getName(), 0, config.ik_timeout);
+		if (found_ik)
+			predictor->statistics.fallback_successes++;
+	}
+	predictor->statistics.ik_nanoseconds += chrono::duration_cast<chrono::nanoseconds>(
+			chrono::steady_clock::now() - ik_start).count();
+	return found_ik;
+}
+
+/** Copy of the state with its transforms computed, waypoints are read by the collision check thread */
+static robot_state::RobotStatePtr makeWaypoint(const robot_state::RobotState& kinematic_state){
+	robot_state::RobotStatePtr state(new robot_state::RobotState(kinematic_state));
+	state->update();
+	return state;
+}
+
+bool linearInterpolation(Trail& trail, robot_state::RobotState kinematic_state, const Eigen::Affine3d& goal_transform,
+                         size_t translation_steps, const PlannerConfig& config, bool global_reference_frame){
+
+	const robot_state::JointModelGroup* jmg_ptr = kinematic_state.getJointModelGroup(config.planning_group);
+	trail.push_back(makeWaypoint(kinematic_state));
+	const moveit::core::LinkModel* ptr_link_model = kinematic_state.getLinkModel(config.end_effector);
+
+	Eigen::Affine3d start_pose = kinematic_state.getGlobalLinkTransform(ptr_link_model);
+
+	// the target can be in the local reference frame (in which case we rotate it)
+	Eigen::Affine3d rotated_target = global_reference_frame ? goal_transform : start_pose * goal_transform;
+
+	Eigen::Quaterniond start_quaternion(start_pose.rotation());
+	Eigen::Quaterniond target_quaternion(rotated_target.rotation());
+
+	size_t steps = translation_steps + 1;
+
+	RequestMemory* memory = MemoryRequestScope::current();
+	for (size_t i = 1; i <= steps; ++i)
+	{
+		if (memory)
+			memory->checkBudget();
+		double percentage = (double)i / (double)steps;
+
+		Eigen::Affine3d pose(start_quaternion.slerp(percentage, target_quaternion));
+
+		pose.translation() = percentage * rotated_target.translation() + (1 - percentage) * start_pose.translation();
+
+		if (solveStepIK(kinematic_state, jmg_ptr, ptr_link_model, pose, config))
+			trail.push_back(makeWaypoint(kinematic_state));
+		else{
+			ROS_ERROR("Impossible to create whole path! Check self-collision or limits excess.");
+			trail.clear();
+			return false;
+		}
+
+	}
+
+	return true;
+}
+
+bool jointInterpolation(Trail& trail, const robot_state::RobotState& kinematic_state, const Eigen::Affine3d& goal_transform,
+                        const PlannerConfig& config, bool global_reference_frame){
+
+	const robot_state::JointModelGroup* jmg_ptr = kinematic_state.getJointModelGroup(config.planning_group);
+	const Eigen::Affine3d start_pose = kinematic_state.getGlobalLinkTransform(config.end_effector);
+	Eigen::Affine3d rotated_target = global_reference_frame ? goal_transform : start_pose * goal_transform;
+
+	//trac-ik starts from the start state, so the goal solution stays in its branch whenever possible
+	robot_state::RobotState goal_state(kinematic_state);
+	if (!solveIK(goal_state, jmg_ptr, goal_state.getLinkModel(config.end_effector), rotated_target, config)){
+		ROS_ERROR("Goal is out of reach in joint space!");
+		return false;
+	}
+	jointInterpolation(trail, kinematic_state, goal_state, config);
+	return true;
+}
+
+void jointInterpolation(Trail& trail, const robot_state::RobotState& kinematic_state,
+                        const robot_state::RobotState& goal_state, const PlannerConfig& config){
+
+	const robot_state::JointModelGroup* jmg_ptr = kinematic_state.getJointModelGroup(config.planning_group);
+	vector<double> start_positions, goal_positions;
+	kinematic_state.copyJointGroupPositions(jmg_ptr, start_positions);
+	goal_state.copyJointGroupPositions(jmg_ptr, goal_positions);
+	double joint_motion = 0;
+	for (size_t joint_idx = 0; joint_idx < start_positions.size(); ++joint_idx)
+		joint_motion = max(joint_motion, fabs(goal_positions[joint_idx] - start_positions[joint_idx]));
+	size_t steps = max(1.0, ceil(joint_motion / JOINT_INTERPOLATION_STEP));
+
+	trail.push_back(makeWaypoint(kinematic_state));
+	for (size_t i = 1; i <= steps; ++i){
+		robot_state::RobotStatePtr state(new robot_state::RobotState(kinematic_state));
+		kinematic_state.interpolate(goal_state, (double)i / (double)steps, *state);
+		state->update();
+		trail.push_back(state);
+	}
+}
+
+double getFullTranslation(const robot_state::RobotStatePtr state, const robot_state::RobotStatePtr next_state,
+                          Eigen::Vector3d& link_extends, string link_name){
+
+	const Eigen::Affine3d state_transform = state->getGlobalLinkTransform(link_name);
+	const Eigen::Affine3d next_state_transform = next_state->getGlobalLinkTransform(link_name);
+	Eigen::Quaterniond start_quaternion(state_transform.rotation());
+	Eigen::Quaterniond target_quaternion(next_state_transform.rotation());
+
+	double diagonal_length = sqrt(pow(link_extends[0], 2) + pow(link_extends[1], 2) + pow(link_extends[2], 2));
+
+	//Translate origin on diagonal length
+	return fullTranslationBound((state_transform.translation() - next_state_transform.translation()).norm(),
+	                            state_transform.translation().norm(), diagonal_length,
+	                            start_quaternion.angularDistance(target_quaternion));
+
+}
+
+/** getFullTranslation from the transform table of the request when it holds the link */
+static double linkTranslation(const robot_state::RobotStatePtr& state, const robot_state::RobotStatePtr& next_state,
+                              Eigen::Vector3d& link_extends, const robot_state::LinkModel* link){
+	LinkTransformTable* transforms = LinkTransformScope::current();
+	int link_idx = transforms ? transforms->linkIndex(link) : -1;
+	if (link_idx < 0)
+		return getFullTranslation(state, next_state, link_extends, link->getName());
+	return transforms->fullTranslation(transforms->waypoint(state), transforms->waypoint(next_state), link_idx);
+}
+
+/** Waypoint between two neighbours, nullptr if trac-ik can't reach the Cartesian one */
+static robot_state::RobotStatePtr bisect(const robot_state::RobotStatePtr& state,
+                                         const robot_state::RobotStatePtr& next_state,
+                                         const PlannerConfig& config, bool joint_space){
+	if (joint_space){
+		robot_state::RobotStatePtr middle_state(new robot_state::RobotState(*state));
+		state->interpolate(*next_state, 0.5, *middle_state);
+		middle_state->update();
+		return middle_state;
+	}
+	Trail segment_to_check;
+	if (!linearInterpolation(segment_to_check, *state, next_state->getGlobalLinkTransform(config.end_effector), 1,
+	                         config))
+		return robot_state::RobotStatePtr();
+	return *++segment_to_check.begin();
+}
+
+double getLinkClearance(const planning_scene::PlanningScene& scene, const robot_state::RobotState& state,
+                        const collision_detection::AllowedCollisionMatrix& link_acm){
+	double world_clearance = scene.getCollisionWorld()->distanceRobot(*scene.getCollisionRobot(), state, link_acm);
+	//Both links of a pair move, each one may close half of the gap between them
+	double self_clearance = scene.getCollisionRobot()->distanceSelf(state, link_acm) / 2;
+	return min(world_clearance, self_clearance);
+}
+
+collision_detection::AllowedCollisionMatrix getLinkClearanceMatrix(const planning_scene::PlanningScene& scene,
+                                                                   const robot_state::LinkModel* link){
+	collision_detection::AllowedCollisionMatrix link_acm(scene.getAllowedCollisionMatrix());
+	const vector<const robot_state::LinkModel*>& links = scene.getRobotModel()->getLinkModelsWithCollisionGeometry();
+	for (size_t link_idx = 0; link_idx < links.size(); ++link_idx){
+		if (links[link_idx] == link)
+			continue;
+		link_acm.setDefaultEntry(links[link_idx]->getName(), true);
+		//The scene lists every pair of links, the pairs without this link are allowed explicitly
+		for (size_t other_idx = link_idx + 1; other_idx < links.size(); ++other_idx)
+			if (links[other_idx] != link)
+				link_acm.setEntry(links[link_idx]->getName(), links[other_idx]->getName(), true);
+	}
+	return link_acm;
+}
+
+void findLinkDistance(Trail& trail, const robot_state::LinkModel* link, const PlannerConfig& config, bool joint_space,
+                      const planning_scene::PlanningSceneConstPtr& scene){
+
+	PerfStageScope perf_scope(STAGE_LINK_DISTANCE);
+
+	//Work with the greatest translation of the link
+	//Get shape dimensions
+	const shapes::Shape* link_mesh_ptr = link->getShapes()[0].get();
+	Eigen::Vector3d link_extends = shapes::computeShapeExtents(link_mesh_ptr);
+	double critical_distance = config.distance_constraint;
+
+	bool clearance_adaptive = scene && config.clearance_factor > 0;
+	collision_detection::AllowedCollisionMatrix link_acm;
+	if (clearance_adaptive)
+		link_acm = getLinkClearanceMatrix(*scene, link);
+
+	RequestMemory* memory = MemoryRequestScope::current();
+	RefinementReport* report = RefinementReportScope::current();
+	size_t attempt = 1;
+	size_t segment_idx = 0;
+	for (Trail::iterator state_it = trail.begin(); state_it != --trail.end(); ++state_it, ++segment_idx){
+		if (memory)
+			memory->checkBudget();
+
+		//getFullTranslation bounds the whole segment, a fraction of the clearance at its start can't reach anything
+		if (clearance_adaptive)
+			critical_distance = max(config.distance_constraint, min(MAX_CLEARANCE_STEP,
+					config.clearance_factor * getLinkClearance(*scene, **state_it, link_acm)));
+
+		Trail::iterator next_state_it = state_it;
+		next_state_it++;
+
+		//Remember previous translation distance to find out whether jump happened
+		double translation_distance = linkTranslation(*state_it, *next_state_it, link_extends, link);
+		double previous_translation_distance = translation_distance;
+		RefinementRecord record;
+		record.bisections = 0;
+		if (report){
+			record.link = link->getName();
+			record.segment = segment_idx;
+			record.initial_distance = translation_distance;
+			record.allowed_distance = critical_distance;
+			record.start_position = (*state_it)->getGlobalLinkTransform(link).translation();
+			record.end_position = (*next_state_it)->getGlobalLinkTransform(link).translation();
+		}
+
+		while (translation_distance > critical_distance){
+			record.bisections++;
+			KT_TRACE_WARN(TRACE_LINK_BISECTION, link->getName().c_str(), translation_distance);
+			robot_state::RobotStatePtr middle_state = bisect(*state_it, *next_state_it, config, joint_space);
+			if (middle_state){
+				trail.insert(next_state_it, middle_state);
+				next_state_it--;
+				translation_distance = linkTranslation(*state_it, *next_state_it, link_extends, link);
+			}
+			else {
+				ROS_ERROR("Space jump happened!");
+				throw runtime_error("Invalid trajectory!");
+			}
+
+		}
+
+		((previous_translation_distance / 2) > translation_distance) ? attempt++ : attempt = 1;
+		if (report){
+			record.final_distance = translation_distance;
+			record.attempt = attempt;
+			report->add(record);
+		}
+
+		if (attempt == config.attempt_number){
+			ROS_ERROR("Space jump happened!");
+			throw runtime_error("Invalid trajectory!");
+		}
+		KT_TRACE_INFO(TRACE_LINK_TRANSLATION, link->getName().c_str(), translation_distance);
+	}
+
+}
+
+double getPeakLinkTranslation(const Trail& trail, const robot_state::LinkModel* link){
+	Eigen::Vector3d link_extends = shapes::computeShapeExtents(link->getShapes()[0].get());
+	double peak_translation = 0;
+	for (Trail::const_iterator state_it = trail.begin(); state_it != trail.end() && next(state_it) != trail.end();
+			++state_it)
+		peak_translation = max(peak_translation, linkTranslation(*state_it, *next(state_it), link_extends, link));
+	return peak_translation;
+}
+
+void check_collision(Trail traj, planning_scene::PlanningScenePtr current_scene, string planning_group){
+	PerfStageScope perf_scope(STAGE_COLLISION);
+	RequestMemory* memory = MemoryRequestScope::current();
+	if (memory)
+		memory->checkBudget();
+	for (robot_state::RobotStatePtr state : traj){
+		if (current_scene->isStateColliding(*state, planning_group, true)){
+			ROS_ERROR("Collision during the trajectory processing!");
+			throw runtime_error("Invalid trajectory!");
+		}
+	}
+}
+
+/** Self and world collisions of the state with the padded robot of the scene */
+static bool isPaddedStateColliding(const planning_scene::PlanningScenePtr& padded_scene,
+                                   const robot_state::RobotState& state,
+                                   const collision_detection::CollisionRequest& request){
+	PerfStageScope perf_scope(STAGE_PADDED_COLLISION);
+	const collision_detection::CollisionRobotConstPtr& padded_robot = padded_scene->getCollisionRobot();
+	collision_detection::CollisionResult result;
+	padded_robot->checkSelfCollision(request, result, state, padded_scene->getAllowedCollisionMatrix());
+	if (!result.collision)
+		padded_scene->getCollisionWorld()->checkRobotCollision(request, result, *padded_robot, state,
+		                                                       padded_scene->getAllowedCollisionMatrix());
+	return result.collision;
+}
+
+void checkPaddedCollision(Trail& trail, const vector<const robot_state::LinkModel*>& links,
+                          const planning_scene::PlanningScenePtr& current_scene, const PlannerConfig& config,
+                          bool joint_space){
+
+	//The child scene owns a copy of the collision robot, the padding stays out of other requests
+	planning_scene::PlanningScenePtr padded_scene = current_scene->diff();
+	const collision_detection::CollisionRobotPtr& padded_robot = padded_scene->getCollisionRobotNonConst();
+	collision_detection::CollisionRequest request;
+	request.group_name = config.planning_group;
+
+	vector<Eigen::Vector3d> link_extends;
+	map<string, double> padding;
+	for (const robot_state::LinkModel* link : links){
+		link_extends.push_back(shapes::computeShapeExtents(link->getShapes()[0].get()));
+		padding[link->getName()] = 0;
+	}
+	padded_robot->setLinkPadding(padding);
+	double critical_distance = config.distance_constraint;
+
+	RequestMemory* memory = MemoryRequestScope::current();
+	RefinementReport* report = RefinementReportScope::current();
+	size_t attempt = 1;
+	size_t padded_queries = 0;
+	size_t segment_idx = 0;
+	for (Trail::iterator state_it = trail.begin(); state_it != --trail.end(); ++state_it, ++segment_idx){
+		if (memory)
+			memory->checkBudget();
+
+		Trail::iterator next_state_it = state_it;
+		next_state_it++;
+		double translation_distance = 0;
+		double previous_translation_distance = -1;
+		//Padded segments are explained by their widest link
+		RefinementRecord record;
+		record.bisections = 0;
+
+		while (true){
+			//Multiples of the constraint keep the collision geometry from being rebuilt for every segment
+			map<string, double> segment_padding;
+			translation_distance = 0;
+			const robot_state::LinkModel* widest_link = links.front();
+			for (size_t link_idx = 0; link_idx < links.size(); ++link_idx){
+				double link_translation = linkTranslation(*state_it, *next_state_it, link_extends[link_idx],
+				                                          links[link_idx]);
+				if (link_translation > translation_distance){
+					translation_distance = link_translation;
+					widest_link = links[link_idx];
+				}
+				segment_padding[links[link_idx]->getName()] = link_translation > critical_distance ?
+						ceil(link_translation / critical_distance) * critical_distance : 0.0;
+			}
+			if (previous_translation_distance < 0){
+				previous_translation_distance = translation_distance;
+				if (report){
+					record.link = widest_link->getName();
+					record.segment = segment_idx;
+					record.initial_distance = translation_distance;
+					record.allowed_distance = critical_distance;
+					record.start_position = (*state_it)->getGlobalLinkTransform(widest_link).translation();
+					record.end_position = (*next_state_it)->getGlobalLinkTransform(widest_link).translation();
+				}
+			}
+			if (segment_padding != padding){
+				padded_robot->setLinkPadding(segment_padding);
+				padding = segment_padding;
+			}
+
+			padded_queries++;
+			if (!isPaddedStateColliding(padded_scene, **state_it, request))
+				break;
+			//Within the constraint nothing is padded, like a state of the dense pipeline
+			if (translation_distance <= critical_distance){
+				ROS_ERROR("Collision during the trajectory processing!");
+				throw runtime_error("Invalid trajectory!");
+			}
+
+			KT_TRACE_WARN(TRACE_LINK_BISECTION, widest_link->getName().c_str(), translation_distance);
+			robot_state::RobotStatePtr middle_state;
+			{
+				PerfStageScope perf_scope(STAGE_LINK_DISTANCE);
+				middle_state = bisect(*state_it, *next_state_it, config, joint_space);
+			}
+			if (!middle_state){
+				ROS_ERROR("Space jump happened!");
+				throw runtime_error("Invalid trajectory!");
+			}
+			trail.insert(next_state_it, middle_state);
+			next_state_it--;
+			record.bisections++;
+		}
+
+		((previous_translation_distance / 2) > translation_distance) ? attempt++ : attempt = 1;
+		if (report){
+			record.final_distance = translation_distance;
+			record.attempt = attempt;
+			report->add(record);
+		}
+
+		if (attempt == config.attempt_number){
+			ROS_ERROR("Space jump happened!");
+			throw runtime_error("Invalid trajectory!");
+		}
+	}
+
+	//Nothing moves after the last state
+	padded_queries++;
+	if (current_scene->isStateColliding(*trail.back(), config.planning_group, true)){
+		ROS_ERROR("Collision during the trajectory processing!");
+		throw runtime_error("Invalid trajectory!");
+	}
+	ROS_DEBUG("Padded collision: %lu waypoints, %lu collision queries", trail.size(), padded_queries);
+}
+
+void setToStartState(robot_state::RobotState& kinematic_state, const PlannerConfig& config){
+	kinematic_state.setToDefaultValues();
+	const robot_state::JointModelGroup* jmg_ptr = kinematic_state.getJointModelGroup(config.planning_group);
+	const Eigen::Affine3d end_effector_frame = kinematic_state.getGlobalLinkTransform(config.end_effector);
+	kinematic_state.setFromIK(jmg_ptr, end_effector_frame, config.end_effector);
+}
+
+vector<const robot_state::LinkModel*> getRefinedLinks(const robot_model::RobotModelConstPtr& kinematic_model){
+	vector<const robot_state::LinkModel*> links;
+	//Don't process base_link
+	for (size_t link_idx = 1; link_idx <= kinematic_model->getLinkGeometryCount() - 1; link_idx++)
+		links.push_back(kinematic_model->getLinkModel(string("link_") + to_string(link_idx)));
+	return links;
+}
+
+/** Report the first (cold) call of a warm-up stage against the mean of the following ones */
+static void reportWarmUpStage(const string& stage, const vector<double>& latencies){
+	double warm_sum = 0;
+	for (size_t i = 1; i < latencies.size(); ++i)
+		warm_sum += latencies[i];
+	double warm_mean = latencies.size() > 1 ? warm_sum / (latencies.size() - 1) : 0.0;
+	ROS_INFO("Warm-up %s: cold %.3f ms, warm %.3f ms", stage.c_str(), latencies.front(), warm_mean);
+}
+
+CartesianPathPlanner::CartesianPathPlanner(const robot_model::RobotModelConstPtr& kinematic_model,
+                                           const planning_scene::PlanningScenePtr& current_scene,
+                                           const PlannerConfig& config) :
+		kinematic_model_(kinematic_model), current_scene_(current_scene), config_(config),
+		analyzer_(kinematic_model, config.planning_group, config.end_effector, getRefinedLinks(kinematic_model),
+		          {config.tool_speed, config.tool_angular_speed, config.max_joint_jerk, config.max_cartesian_deviation,
+		           config.padded_collision || config.clearance_factor > 0 ? 0.0 : config.distance_constraint}){
+	transform_links_ = getRefinedLinks(kinematic_model);
+	const robot_state::LinkModel* end_effector = kinematic_model->getLinkModel(config_.end_effector);
+	if (find(transform_links_.begin(), transform_links_.end(), end_effector) == transform_links_.end())
+		transform_links_.push_back(end_effector);
+	if (config_.memory_budget_bytes && !isAllocationAccountingInstalled())
+		ROS_WARN("memory_budget_mb needs the allocation hooks of the offline tools, it isn't enforced here");
+	if (config_.controller_rate > 0)
+		resampler_.reset(new ControllerResampler(kinematic_model, config_.planning_group,
+		                                         getRefinedLinks(kinematic_model), config_.distance_constraint,
+		                                         config_.controller_rate));
+}
+
+bool CartesianPathPlanner::interpolate(Trail& trail, const robot_state::RobotState& start_state,
+                                       const Eigen::Affine3d& goal_transform, bool global_reference_frame) const{
+
+	PerfStageScope perf_scope(STAGE_INTERPOLATION);
+	robot_state::RobotState kinematic_state(start_state);
+	const Eigen::Affine3d start_pose = kinematic_state.getGlobalLinkTransform(config_.end_effector);
+	Eigen::Vector3d goal_translation = global_reference_frame ?
+			Eigen::Vector3d(goal_transform.translation() - start_pose.translation()) :
+			Eigen::Vector3d(goal_transform.translation());
+	size_t approximate_steps = floor(goal_translation.norm() / config_.interpolation_step);
+	return linearInterpolation(trail, kinematic_state, goal_transform, approximate_steps, config_,
+	                           global_reference_frame);
+}
+
+void CartesianPathPlanner::refine(Trail& trail, bool joint_space) const{
+	if (config_.padded_collision){
+		checkPaddedCollision(trail, getRefinedLinks(kinematic_model_), current_scene_, config_, joint_space);
+		return;
+	}
+	RequestMemory* memory = MemoryRequestScope::current();
+	for (const robot_state::LinkModel* link : getRefinedLinks(kinematic_model_)){
+		//The worker adopts the request for memory accounting. The future carries its exception back, and when
+		//findLinkDistance throws first its destructor waits for the worker, a thread is never left joinable
+		future<void> collision_check = async(launch::async, [this, memory](Trail traj){
+			MemoryRequestScope memory_scope(memory);
+			check_collision(traj, current_scene_, config_.planning_group);
+		}, trail);
+		findLinkDistance(trail, link, config_, joint_space, current_scene_);
+		collision_check.get();
+	}
+}
+
+bool CartesianPathPlanner::planInSpace(Trail& trail, const robot_state::RobotState& start_state,
+                                       const Eigen::Affine3d& goal_transform, bool global_reference_frame,
+                                       bool joint_space) const{
+	trail.clear();
+	try {
+		bool is_interpolated = joint_space ?
+				jointInterpolation(trail, start_state, goal_transform, config_, global_reference_frame) :
+				interpolate(trail, start_state, goal_transform, global_reference_frame);
+		if (!is_interpolated)
+			return false;
+		refine(trail, joint_space);
+	}
+	catch (const exception& error){
+		ROS_ERROR("%s", error.what());
+		return false;
+	}
+	return true;
+}
+
+bool CartesianPathPlanner::plan(Trail& trail, const robot_state::RobotState& start_state,
+                                const Eigen::Affine3d& goal_transform, bool global_reference_frame,
+                                PathPolicy policy, RequestMemory* memory, TrajectoryMetrics* metrics,
+                                robot_trajectory::RobotTrajectory* trajectory) const{
+
+	//A memory of the caller keeps its own budget
+	RequestMemory request_memory(config_.memory_budget_bytes);
+	if (!memory)
+		memory = &request_memory;
+
+	RequestSeeds unnamed_seeds("");
+	SeedRequestScope seed_scope(SeedRequestScope::current() ? SeedRequestScope::current() : &unnamed_seeds);
+	LinkTransformTable request_transforms(kinematic_model_->getJointModelGroup(config_.planning_group),
+	                                      transform_links_);
+	LinkTransformScope transform_scope(LinkTransformScope::current() ? LinkTransformScope::current() :
+	                                   &request_transforms);
+
+	bool is_planned = false;
+	{
+		MemoryRequestScope memory_scope(memory);
+		bool joint_space = policy == PATH_JOINT;
+		is_planned = planInSpace(trail, start_state, goal_transform, global_reference_frame, joint_space);
+		if (!is_planned && policy == PATH_JOINT_FALLBACK){
+			ROS_WARN("Cartesian path failed, falling back to joint space");
+			//The report explains the trail that is returned, not the failed attempt
+			if (RefinementReportScope::current())
+				RefinementReportScope::current()->clear();
+			joint_space = true;
+			is_planned = planInSpace(trail, start_state, goal_transform, global_reference_frame, joint_space);
+		}
+		is_planned = is_planned && validateExecution(trail, !joint_space, metrics, trajectory);
+	}
+	memory->peak_rss_bytes = getPeakRssBytes();
+	if (!is_planned){
+		trail.clear();
+		if (trajectory)
+			trajectory->clear();
+	}
+	return is_planned;
+}
+
+bool CartesianPathPlanner::validateExecution(const Trail& trail, bool cartesian, TrajectoryMetrics* metrics,
+                                             robot_trajectory::RobotTrajectory* trajectory) const{
+	if (config_.tool_speed > 0){
+		PerfStageScope perf_scope(STAGE_ANALYTICS);
+		TrajectoryMetrics request_metrics;
+		if (!metrics)
+			metrics = &request_metrics;
+		analyzer_.analyze(trail, cartesian, *metrics);
+		if (!metrics->violation.empty()){
+			ROS_ERROR("Trajectory rejected: %s", metrics->violation.c_str());
+			return false;
+		}
+	}
+
+	robot_trajectory::RobotTrajectory request_trajectory(kinematic_model_, config_.planning_group);
+	if (resampler_){
+		PerfStageScope perf_scope(STAGE_RESAMPLING);
+		ResamplingReport report;
+		resampler_->check(trail, *current_scene_, trajectory ? *trajectory : request_trajectory, report);
+		ROS_DEBUG("Resampled %lu controller ticks over %.3f s, %lu segments flagged, %lu collision queries",
+		          report.sample_count, report.duration, report.flagged_segments, report.collision_queries);
+		if (!report.violation.empty()){
+			ROS_ERROR("Trajectory rejected: %s", report.violation.c_str());
+			return false;
+		}
+	}
+	else if (trajectory && !timeTrail(trail, *trajectory)){
+		ROS_ERROR("Trajectory rejected: time parameterization failed");
+		return false;
+	}
+	return true;
+}
+
+bool CartesianPathPlanner::planJointMove(Trail& trail, const robot_state::RobotState& start_state,
+                                         const robot_state::RobotState& goal_state) const{
+	RequestMemory memory(config_.memory_budget_bytes);
+	MemoryRequestScope memory_scope(&memory);
+	LinkTransformTable request_transforms(kinematic_model_->getJointModelGroup(config_.planning_group),
+	                                      transform_links_);
+	LinkTransformScope transform_scope(LinkTransformScope::current() ? LinkTransformScope::current() :
+	                                   &request_transforms);
+	trail.clear();
+	try {
+		jointInterpolation(trail, start_state, goal_state, config_);
+		refine(trail, true);
+	}
+	catch (const exception& error){
+		ROS_ERROR("%s", error.what());
+		trail.clear();
+		return false;
+	}
+	if (!validateExecution(trail, false, nullptr, nullptr)){
+		trail.clear();
+		return false;
+	}
+	return true;
+}
+
+void CartesianPathPlanner::warmUp(const robot_state::RobotState& start_state) const{
+
+	robot_state::RobotState kinematic_state(start_state);
+	const robot_state::JointModelGroup* jmg_ptr = kinematic_state.getJointModelGroup(config_.planning_group);
+	const robot_state::LinkModel* end_effector = kinematic_state.getLinkModel(config_.end_effector);
+	vector<const robot_state::LinkModel*> links = getRefinedLinks(kinematic_model_);
+
+	//Worker threads take their rings from the pool instead of allocating on the first record
+	TraceLogger::instance().reserveRings(WARM_UP_TRACE_RINGS);
+
+	vector<double> fk_latencies, ik_latencies, distance_latencies, collision_latencies;
+	robot_state::RobotStatePtr state(new robot_state::RobotState(kinematic_state));
+	robot_state::RobotStatePtr next_state(new robot_state::RobotState(kinematic_state));
+
+	for (size_t i = 0; i < config_.warm_up_iterations; ++i){
+		state->setToRandomPositions(jmg_ptr);
+		next_state->setToRandomPositions(jmg_ptr);
+
+		chrono::steady_clock::time_point stage_start = chrono::steady_clock::now();
+		const Eigen::Affine3d target = state->getGlobalLinkTransform(end_effector);
+		next_state->getGlobalLinkTransform(end_effector);
+		chrono::steady_clock::time_point stage_end = chrono::steady_clock::now();
+		fk_latencies.push_back(chrono::duration<double, milli>(stage_end - stage_start).count());
+
+		stage_start = chrono::steady_clock::now();
+		kinematic_state.setFromIK(jmg_ptr, target, end_effector->getName());
+		stage_end = chrono::steady_clock::now();
+		ik_latencies.push_back(chrono::duration<double, milli>(stage_end - stage_start).count());
+
+		stage_start = chrono::steady_clock::now();
+		for (const robot_state::LinkModel* link : links){
+			Eigen::Vector3d link_extends = shapes::computeShapeExtents(link->getShapes()[0].get());
+			getFullTranslation(state, next_state, link_extends, link->getName());
+		}
+		stage_end = chrono::steady_clock::now();
+		distance_latencies.push_back(chrono::duration<double, milli>(stage_end - stage_start).count());
+
+		stage_start = chrono::steady_clock::now();
+		current_scene_->isStateColliding(*state, config_.planning_group, true);
+		stage_end = chrono::steady_clock::now();
+		collision_latencies.push_back(chrono::duration<double, milli>(stage_end - stage_start).count());
+	}
+
+	if (config_.warm_up_iterations == 0)
+		return;
+	reportWarmUpStage("forward kinematics", fk_latencies);
+	reportWarmUpStage("inverse kinematics", ik_latencies);
+	reportWarmUpStage("link distance", distance_latencies);
+	reportWarmUpStage("collision check", collision_latencies);
+}
+
+vector<geometry_msgs::Pose> CartesianPathPlanner::toPoses(const Trail& trail) const{
+	vector<geometry_msgs::Pose> waypoints;
+	LinkTransformTable* transforms = LinkTransformScope::current();
+	const robot_state::LinkModel* end_effector = kinematic_model_->getLinkModel(config_.end_effector);
+	int end_effector_idx = transforms ? transforms->linkIndex(end_effector) : -1;
+	for (robot_state::RobotStatePtr state : trail){
+		Eigen::Affine3d pose = end_effector_idx < 0 ? state->getGlobalLinkTransform(end_effector) :
+				transforms->transform(transforms->waypoint(state), end_effector_idx);
+		waypoints.push_back(tf2::toMsg(pose));
+	}
+	return waypoints;
+}
+
+robot_trajectory::RobotTrajectoryPtr CartesianPathPlanner::toRobotTrajectory(const Trail& trail) const{
+	robot_trajectory::RobotTrajectoryPtr trajectory(
+			new robot_trajectory::RobotTrajectory(kinematic_model_, config_.planning_group));
+	for (robot_state::RobotStatePtr state : trail)
+		trajectory->addSuffixWayPoint(state, 0.0);
+	return trajectory;
+}
+
+}
@@ -0,0 +1,70 @@
+#include <kinematics_test/compact_trajectory.h>
+
+#include <map>
+#include <geometric_shapes/shape_operations.h>
+#include <moveit/robot_model/prismatic_joint_model.h>
+#include <moveit/robot_model/revolute_joint_model.h>
+
+using namespace std;
+using namespace moveit;
+using namespace core;
+
+namespace kinematics_test {
+
+namespace {
+
+/** Add the joint after the joints above it, return its index */
+int addChainJoint(const robot_state::JointModel* joint_model, const robot_state::JointModelGroup* jmg_ptr,
+                  map<const robot_state::JointModel*, int>& indices, ChainJoints& joints){
+	map<const robot_state::JointModel*, int>::const_iterator known = indices.find(joint_model);
+	if (known != indices.end())
+		return known->second;
+
+	ChainJoint joint;
+	const robot_state::LinkModel* parent_link = joint_model->getParentLinkModel();
+	joint.parent = parent_link ? addChainJoint(parent_link->getParentJointModel(), jmg_ptr, indices, joints) : -1;
+	joint.origin = Eigen::Isometry3d(joint_model->getChildLinkModel()->getJointOriginTransform().matrix());
+	joint.axis = Eigen::Vector3d::UnitZ();
+	joint.prismatic = false;
+	joint.variable_idx = -1;
+	switch (joint_model->getType()){
+		case robot_state::JointModel::FIXED:
+			break;
+		case robot_state::JointModel::REVOLUTE:
+			joint.axis = static_cast<const robot_state::RevoluteJointModel*>(joint_model)->getAxis();
+			joint.variable_idx = jmg_ptr->getVariableGroupIndex(joint_model->getName());
+			break;
+		case robot_state::JointModel::PRISMATIC:
+			joint.axis = static_cast<const robot_state::PrismaticJointModel*>(joint_model)->getAxis();
+			joint.prismatic = true;
+			joint.variable_idx = jmg_ptr->getVariableGroupIndex(joint_model->getName());
+			break;
+		default:
+			throw runtime_error("Joint " + joint_model->getName() + " isn't supported by the compact kinematics");
+	}
+	if (joint_model->getType() != robot_state::JointModel::FIXED && joint.variable_idx < 0)
+		throw runtime_error("Joint " + joint_model->getName() + " isn't part of " + jmg_ptr->getName());
+
+	indices[joint_model] = joints.size();
+	joints.push_back(joint);
+	return joints.size() - 1;
+}
+
+}
+
+ChainKinematics::ChainKinematics(const robot_state::JointModelGroup* jmg_ptr,
+                                 const vector<const robot_state::LinkModel*>& links) : reach_(0){
+	map<const robot_state::JointModel*, int> indices;
+	link_diagonals_.resize(links.size());
+	for (size_t link_idx = 0; link_idx < links.size(); ++link_idx){
+		link_joints_.push_back(addChainJoint(links[link_idx]->getParentJointModel(), jmg_ptr, indices, joints_));
+		link_diagonals_[link_idx] = shapes::computeShapeExtents(links[link_idx]->getShapes()[0].get()).norm();
+	}
+	for (const ChainJoint& joint : joints_){
+		double_origins_.push_back(joint.origin);
+		float_origins_.push_back(joint.origin.cast<float>());
+		reach_ += joint.origin.translation().norm();
+	}
+}
+
+}
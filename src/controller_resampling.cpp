@@ -0,0 +1,118 @@
+#include <kinematics_test/controller_resampling.h>
+
+#include <sstream>
+#include <moveit/trajectory_processing/iterative_time_parameterization.h>
+
+using namespace std;
+using namespace moveit;
+using namespace core;
+
+namespace kinematics_test {
+
+bool timeTrail(const Trail& trail, robot_trajectory::RobotTrajectory& trajectory){
+	trajectory.clear();
+	for (const robot_state::RobotStatePtr& state : trail)
+		trajectory.addSuffixWayPoint(state, 0.0);
+	trajectory_processing::IterativeParabolicTimeParameterization time_parameterization;
+	return time_parameterization.computeTimeStamps(trajectory);
+}
+
+ControllerResampler::ControllerResampler(const robot_model::RobotModelConstPtr& kinematic_model,
+                                         const string& planning_group,
+                                         const vector<const robot_state::LinkModel*>& links,
+                                         double distance_constraint, double controller_rate) :
+		kinematic_model_(kinematic_model), jmg_ptr_(kinematic_model->getJointModelGroup(planning_group)),
+		chain_(jmg_ptr_, links), distance_constraint_(distance_constraint), controller_rate_(controller_rate){}
+
+void ControllerResampler::check(const Trail& trail, const planning_scene::PlanningScene& scene,
+                                robot_trajectory::RobotTrajectory& trajectory, ResamplingReport& report) const{
+
+	report.duration = 0;
+	report.sample_count = 0;
+	report.flagged_segments = 0;
+	report.collision_queries = 0;
+	report.violation.clear();
+	if (!timeTrail(trail, trajectory)){
+		report.violation = "time parameterization failed";
+		return;
+	}
+	if (trail.size() < 2)
+		return;
+
+	size_t joint_count = jmg_ptr_->getVariableCount();
+	size_t waypoint_count = trajectory.getWayPointCount();
+	Eigen::MatrixXd positions(joint_count, waypoint_count);
+	Eigen::MatrixXd velocities(joint_count, waypoint_count);
+	Eigen::MatrixXd accelerations(joint_count, waypoint_count);
+	for (size_t waypoint_idx = 0; waypoint_idx < waypoint_count; ++waypoint_idx){
+		const robot_state::RobotState& state = trajectory.getWayPoint(waypoint_idx);
+		state.copyJointGroupPositions(jmg_ptr_, positions.col(waypoint_idx).data());
+		state.copyJointGroupVelocities(jmg_ptr_, velocities.col(waypoint_idx).data());
+		state.copyJointGroupAccelerations(jmg_ptr_, accelerations.col(waypoint_idx).data());
+	}
+
+	Eigen::Matrix3Xd translations, next_translations, sample_translations;
+	Eigen::Matrix4Xd orientations, next_orientations, sample_orientations;
+	chain_.linkPoses(positions.col(0).data(), next_translations, next_orientations);
+	robot_state::RobotState sample_state(trajectory.getWayPoint(0));
+	for (size_t segment = 0; segment + 1 < waypoint_count; ++segment){
+		translations.swap(next_translations);
+		orientations.swap(next_orientations);
+		chain_.linkPoses(positions.col(segment + 1).data(), next_translations, next_orientations);
+
+		double seconds = trajectory.getWayPointDurationFromPrevious(segment + 1);
+		double segment_start = report.duration;
+		report.duration += seconds;
+		//Controller ticks strictly inside the segment, the waypoints themselves are validated already
+		double first_tick = floor(segment_start * controller_rate_) + 1;
+		size_t tick_count = max(0.0, ceil(report.duration * controller_rate_) - first_tick);
+		if (tick_count == 0 || seconds <= 0)
+			continue;
+		Eigen::ArrayXd times = Eigen::ArrayXd::LinSpaced(tick_count, first_tick, first_tick + tick_count - 1) /
+				controller_rate_ - segment_start;
+		report.sample_count += times.size();
+
+		//Quintic through both ends with their velocities and accelerations, as the controller interpolates
+		Eigen::VectorXd p0 = positions.col(segment), p1 = positions.col(segment + 1);
+		Eigen::VectorXd v0 = velocities.col(segment), v1 = velocities.col(segment + 1);
+		Eigen::VectorXd a0 = accelerations.col(segment), a1 = accelerations.col(segment + 1);
+		double T = seconds, T2 = T * T, T3 = T2 * T;
+		Eigen::VectorXd coefficients[6] = {
+				p0, v0, 0.5 * a0,
+				(20 * (p1 - p0) - (8 * v1 + 12 * v0) * T - (3 * a0 - a1) * T2) / (2 * T3),
+				(30 * (p0 - p1) + (14 * v1 + 16 * v0) * T + (3 * a0 - 2 * a1) * T2) / (2 * T3 * T),
+				(12 * (p1 - p0) - 6 * (v1 + v0) * T - (a0 - a1) * T2) / (2 * T3 * T2)};
+		Eigen::MatrixXd samples = coefficients[5].replicate(1, times.size());
+		for (int power = 4; power >= 0; --power)
+			samples = ((samples.array().rowwise() * times.transpose()).matrix().colwise() + coefficients[power]);
+
+		//The refinement validated this segment for its own swept distance, never less than the constraint
+		Eigen::ArrayXd envelope = chain_.sweptDistance(translations, orientations, next_translations,
+		                                               next_orientations).max(distance_constraint_) +
+				ANALYTICS_TOLERANCE;
+		bool flagged = false;
+		for (size_t sample_idx = 0; sample_idx < (size_t)samples.cols() && !flagged; ++sample_idx){
+			chain_.linkPoses(samples.col(sample_idx).data(), sample_translations, sample_orientations);
+			flagged = (chain_.sweptDistance(translations, orientations, sample_translations,
+			                                sample_orientations) > envelope).any();
+		}
+		if (!flagged)
+			continue;
+
+		report.flagged_segments++;
+		for (size_t sample_idx = 0; sample_idx < (size_t)samples.cols(); ++sample_idx){
+			sample_state.setJointGroupPositions(jmg_ptr_, samples.col(sample_idx).data());
+			sample_state.update();
+			report.collision_queries++;
+			if (scene.isStateColliding(sample_state, jmg_ptr_->getName(), true)){
+				ostringstream violation;
+				violation << "Collision between waypoints " << segment << " and " << segment + 1 << " at "
+				          << segment_start + times[sample_idx] << " s";
+				report.violation = violation.str();
+				return;
+			}
+		}
+	}
+}
+
+}
@@ -0,0 +1,233 @@
+/*********************************************************************
+ * Runs a request corpus through the reference pipeline and through an
+ * optimized configuration side by side. For every request it compares
+ * the validity verdict, the Cartesian deviation between the two end
+ * effector paths and the peak swept distance of every link, and reports
+ * the timing of both. Exits with 1 if any request disagrees.
+ *
+ * Both configurations are read with loadPlannerConfig from the private
+ * namespaces ~reference and ~optimized. --scene loads the world of the
+ * cell from a .scene file, without it both pipelines only check self
+ * collisions and verdicts that depend on the cell can't disagree.
+ *
+ *   differential_harness <corpus> [--deviation-tolerance m] [--swept-tolerance m] [--perf] [--scene file]
+ *
+ * With --perf the hardware counters of both runs are printed per stage.
+ *********************************************************************/
+
+#include <ros/ros.h>
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <stdexcept>
+#include <moveit/robot_model_loader/robot_model_loader.h>
+#include <moveit/planning_scene/planning_scene.h>
+#include <kinematics_test/cartesian_path_planner.h>
+#include <kinematics_test/perf_counters.h>
+#include <kinematics_test/request_corpus.h>
+#include <kinematics_test/startup_loading.h>
+
+#define DEFAULT_ROBOT_DESCRIPTION "robot_description"
+#define DEFAULT_DEVIATION_TOLERANCE 0.001
+#define DEFAULT_SWEPT_TOLERANCE 0.0005
+#define USAGE "Usage: differential_harness <corpus> [--deviation-tolerance m] [--swept-tolerance m] [--perf] [--scene file]"
+
+using namespace std;
+using namespace moveit;
+using namespace core;
+using namespace kinematics_test;
+
+struct PipelineRun {
+	Trail trail;
+	bool is_planned;
+	double planning_ms;
+};
+
+PipelineRun runPipeline(const CartesianPathPlanner& planner, const robot_state::RobotState& start_state,
+                        const PlanningRequest& request){
+	PipelineRun run;
+	RequestSeeds seeds(request.id);
+	SeedRequestScope seed_scope(&seeds);
+	chrono::steady_clock::time_point plan_start = chrono::steady_clock::now();
+	run.is_planned = planner.plan(run.trail, start_state, request.goal_transform, request.global_reference_frame,
+	                              request.path_policy);
+	run.planning_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - plan_start).count();
+	return run;
+}
+
+double distanceToSegment(const Eigen::Vector3d& point, const Eigen::Vector3d& start, const Eigen::Vector3d& end){
+	Eigen::Vector3d segment = end - start;
+	double length_squared = segment.squaredNorm();
+	double t = length_squared > 0 ? max(0.0, min(1.0, (point - start).dot(segment) / length_squared)) : 0.0;
+	return (start + t * segment - point).norm();
+}
+
+/** Greatest distance from a waypoint of one path to the polyline of the other */
+double directedDeviation(const vector<Eigen::Vector3d>& path, const vector<Eigen::Vector3d>& polyline){
+	double deviation = 0;
+	for (const Eigen::Vector3d& point : path){
+		double closest = polyline.size() == 1 ? (point - polyline[0]).norm() : numeric_limits<double>::infinity();
+		for (size_t i = 0; i + 1 < polyline.size(); ++i)
+			closest = min(closest, distanceToSegment(point, polyline[i], polyline[i + 1]));
+		deviation = max(deviation, closest);
+	}
+	return deviation;
+}
+
+vector<Eigen::Vector3d> endEffectorPath(const Trail& trail, const string& end_effector){
+	vector<Eigen::Vector3d> path;
+	for (const robot_state::RobotStatePtr& state : trail)
+		path.push_back(state->getGlobalLinkTransform(end_effector).translation());
+	return path;
+}
+
+/** Throws runtime_error on a value that isn't a number */
+double parseTolerance(const string& value){
+	size_t parsed_length = 0;
+	double tolerance = 0;
+	try {
+		tolerance = stod(value, &parsed_length);
+	}
+	catch (const logic_error&){
+		parsed_length = 0;
+	}
+	if (parsed_length == 0 || parsed_length != value.size())
+		throw runtime_error("Bad tolerance \"" + value + "\"");
+	return tolerance;
+}
+
+int main(int argc, char** argv)
+{
+	ros::init(argc, argv, "differential_harness");
+	if (argc < 2){
+		fprintf(stderr, "%s\n", USAGE);
+		return 1;
+	}
+	double deviation_tolerance = DEFAULT_DEVIATION_TOLERANCE;
+	double swept_tolerance = DEFAULT_SWEPT_TOLERANCE;
+	string scene_path;
+	try {
+		for (int arg_idx = 2; arg_idx < argc; arg_idx += 2){
+			string option = argv[arg_idx];
+			if (option == "--perf"){
+				PerfCounters::enable();
+				arg_idx--;
+			}
+			else if (arg_idx + 1 == argc)
+				throw runtime_error("Option " + option + " needs a value");
+			else if (option == "--deviation-tolerance")
+				deviation_tolerance = parseTolerance(argv[arg_idx + 1]);
+			else if (option == "--swept-tolerance")
+				swept_tolerance = parseTolerance(argv[arg_idx + 1]);
+			else if (option == "--scene")
+				scene_path = argv[arg_idx + 1];
+			else
+				throw runtime_error("Unknown option " + option);
+		}
+	}
+	catch (const runtime_error& error){
+		fprintf(stderr, "%s\n%s\n", error.what(), USAGE);
+		return 1;
+	}
+
+	vector<PlanningRequest> requests = loadRequestCorpus(argv[1]);
+	ros::NodeHandle node_handle;
+	robot_model_loader::RobotModelLoader kt_robot_model_loader(DEFAULT_ROBOT_DESCRIPTION);
+	robot_model::RobotModelConstPtr kt_kinematic_model = kt_robot_model_loader.getModel();
+	planning_scene::PlanningScenePtr kt_planning_scene(new planning_scene::PlanningScene(kt_kinematic_model));
+	if (scene_path.empty())
+		ROS_WARN("No --scene given, both pipelines are only checked for self collisions");
+	else {
+		try {
+			loadSceneGeometry(*kt_planning_scene, scene_path);
+		}
+		catch (const runtime_error& error){
+			ROS_ERROR("%s", error.what());
+			return 1;
+		}
+	}
+
+	PlannerConfig reference_config, optimized_config;
+	loadPlannerConfig(ros::NodeHandle("~reference"), reference_config);
+	loadPlannerConfig(ros::NodeHandle("~optimized"), optimized_config);
+	CartesianPathPlanner reference(kt_kinematic_model, kt_planning_scene, reference_config);
+	CartesianPathPlanner optimized(kt_kinematic_model, kt_planning_scene, optimized_config);
+
+	robot_state::RobotState start_state(kt_kinematic_model);
+	setToStartState(start_state, reference_config);
+	reference.warmUp(start_state);
+	optimized.warmUp(start_state);
+	PerfCounters::reset();
+	vector<const robot_state::LinkModel*> links = getRefinedLinks(kt_kinematic_model);
+
+	vector<PipelineRun> reference_runs, optimized_runs;
+	double reference_ms = 0, optimized_ms = 0;
+	//Each side runs the whole corpus at once so the counters can be reported per side
+	for (const PlanningRequest& request : requests){
+		reference_runs.push_back(runPipeline(reference, start_state, request));
+		reference_ms += reference_runs.back().planning_ms;
+	}
+	if (PerfCounters::isEnabled()){
+		ROS_INFO("Reference counters:");
+		PerfCounters::report();
+		PerfCounters::reset();
+	}
+	for (const PlanningRequest& request : requests){
+		optimized_runs.push_back(runPipeline(optimized, start_state, request));
+		optimized_ms += optimized_runs.back().planning_ms;
+	}
+	if (PerfCounters::isEnabled()){
+		ROS_INFO("Optimized counters:");
+		PerfCounters::report();
+	}
+
+	size_t mismatches = 0;
+	for (size_t request_idx = 0; request_idx < requests.size(); ++request_idx){
+		const PlanningRequest& request = requests[request_idx];
+		const PipelineRun& reference_run = reference_runs[request_idx];
+		const PipelineRun& optimized_run = optimized_runs[request_idx];
+
+		if (reference_run.is_planned != optimized_run.is_planned){
+			ROS_ERROR("%s: verdict differs, reference %s, optimized %s", request.id.c_str(),
+			          reference_run.is_planned ? "valid" : "invalid", optimized_run.is_planned ? "valid" : "invalid");
+			mismatches++;
+			continue;
+		}
+		if (!reference_run.is_planned){
+			ROS_INFO("%s: both invalid", request.id.c_str());
+			continue;
+		}
+
+		bool is_matching = true;
+		vector<Eigen::Vector3d> reference_path = endEffectorPath(reference_run.trail, reference_config.end_effector);
+		vector<Eigen::Vector3d> optimized_path = endEffectorPath(optimized_run.trail, optimized_config.end_effector);
+		double deviation = max(directedDeviation(optimized_path, reference_path),
+		                       directedDeviation(reference_path, optimized_path));
+		if (deviation > deviation_tolerance){
+			ROS_ERROR("%s: Cartesian deviation %.5f m", request.id.c_str(), deviation);
+			is_matching = false;
+		}
+
+		//The optimized path may place waypoints elsewhere, but no link may sweep further than the reference allows
+		for (const robot_state::LinkModel* link : links){
+			double reference_swept = getPeakLinkTranslation(reference_run.trail, link);
+			double optimized_swept = getPeakLinkTranslation(optimized_run.trail, link);
+			if (optimized_swept > max(reference_swept, reference_config.distance_constraint) + swept_tolerance){
+				ROS_ERROR("%s: %s sweeps %.5f m, reference %.5f m", request.id.c_str(), link->getName().c_str(),
+				          optimized_swept, reference_swept);
+				is_matching = false;
+			}
+		}
+
+		mismatches += !is_matching;
+		ROS_INFO("%s: %s, deviation %.5f m, waypoints %lu / %lu, %.1f ms / %.1f ms", request.id.c_str(),
+		         is_matching ? "match" : "MISMATCH", deviation, reference_run.trail.size(), optimized_run.trail.size(),
+		         reference_run.planning_ms, optimized_run.planning_ms);
+	}
+
+	printf("Requests: %lu, mismatches: %lu\n", requests.size(), mismatches);
+	printf("Planning time: reference %.1f ms, optimized %.1f ms, speed-up %.2fx\n", reference_ms, optimized_ms,
+	       optimized_ms > 0 ? reference_ms / optimized_ms : 0.0);
+	return mismatches ? 1 : 0;
+}
@@ -0,0 +1,183 @@
+#include <kinematics_test/execution_monitor.h>
+
+#include <algorithm>
+
+using namespace std;
+using namespace moveit;
+using namespace core;
+
+namespace kinematics_test {
+
+const char* monitorSignalName(MonitorSignal signal){
+	switch (signal){
+		case MONITOR_REPLAN: return "replan";
+		case MONITOR_STOP: return "stop";
+		default: return "clear";
+	}
+}
+
+ExecutionMonitor::ExecutionMonitor(const planning_scene_monitor::PlanningSceneMonitorPtr& live_scene,
+                                   const vector<const robot_state::LinkModel*>& links, const MonitorConfig& config,
+                                   const SignalCallback& signal_callback) :
+		live_scene_(live_scene), config_(config), signal_callback_(signal_callback),
+		jmg_ptr_(live_scene->getRobotModel()->getJointModelGroup(config.planning_group)), links_(links),
+		running_(true), pending_(false), world_generation_(0), current_waypoint_(0), checked_until_(0),
+		raised_signal_(MONITOR_CLEAR){
+	live_scene_->addUpdateCallback([this](planning_scene_monitor::PlanningSceneMonitor::SceneUpdateType type){
+		onSceneUpdate(type);
+	});
+	thread_ = thread(&ExecutionMonitor::run, this);
+}
+
+ExecutionMonitor::~ExecutionMonitor(){
+	live_scene_->clearUpdateCallbacks();
+	{
+		lock_guard<mutex> lock(mutex_);
+		running_ = false;
+	}
+	update_condition_.notify_one();
+	thread_.join();
+}
+
+void ExecutionMonitor::setTrail(const Trail& trail){
+	shared_ptr<MonitoredTrail> monitored_trail(new MonitoredTrail());
+	monitored_trail->waypoints.assign(trail.begin(), trail.end());
+	monitored_trail->positions.resize(jmg_ptr_->getVariableCount(), trail.size());
+	for (size_t waypoint_idx = 0; waypoint_idx < monitored_trail->waypoints.size(); ++waypoint_idx)
+		monitored_trail->waypoints[waypoint_idx]->copyJointGroupPositions(
+				jmg_ptr_, monitored_trail->positions.col(waypoint_idx).data());
+
+	//A sparse trail sweeps more than the distance constraint between its waypoints
+	for (const robot_state::LinkModel* link : links_)
+		monitored_trail->paddings[link->getName()] = getPeakLinkTranslation(trail, link);
+
+	//The new trail is checked right away, the world may have changed since it was planned
+	lock_guard<mutex> lock(mutex_);
+	trail_ = monitored_trail;
+	current_waypoint_ = 0;
+	checked_until_ = 0;
+	raised_signal_ = MONITOR_CLEAR;
+	if (!pending_){
+		pending_ = true;
+		pending_since_ = chrono::steady_clock::now();
+	}
+	update_condition_.notify_one();
+}
+
+void ExecutionMonitor::clear(){
+	lock_guard<mutex> lock(mutex_);
+	trail_.reset();
+}
+
+size_t ExecutionMonitor::getCurrentWaypoint() const{
+	lock_guard<mutex> lock(mutex_);
+	return current_waypoint_;
+}
+
+void ExecutionMonitor::onSceneUpdate(planning_scene_monitor::PlanningSceneMonitor::SceneUpdateType type){
+	lock_guard<mutex> lock(mutex_);
+	//New robot states and transforms only move the horizon, changed world geometry voids the cached results
+	if (type & planning_scene_monitor::PlanningSceneMonitor::UPDATE_GEOMETRY){
+		world_generation_++;
+		checked_until_ = 0;
+	}
+	if (!pending_){
+		pending_ = true;
+		pending_since_ = chrono::steady_clock::now();
+	}
+	update_condition_.notify_one();
+}
+
+void ExecutionMonitor::run(){
+	//The child scene copies the world when it's created, it's rebuilt for a new world, trail or monitored scene
+	planning_scene::PlanningScenePtr padded_scene;
+	shared_ptr<const MonitoredTrail> padded_trail;
+	uint64_t padded_generation = 0;
+	unique_lock<mutex> lock(mutex_);
+	while (true){
+		update_condition_.wait(lock, [this](){ return !running_ || (pending_ && trail_); });
+		if (!running_)
+			return;
+		//Updates arriving during the check are served by the next one
+		pending_ = false;
+		chrono::steady_clock::time_point update_time = pending_since_;
+		shared_ptr<const MonitoredTrail> trail = trail_;
+		uint64_t world_generation = world_generation_;
+		size_t current_waypoint = current_waypoint_;
+		size_t checked_until = checked_until_;
+		lock.unlock();
+
+		MonitorEvent event;
+		{
+			planning_scene_monitor::LockedPlanningSceneRO locked_scene(live_scene_);
+			planning_scene::PlanningSceneConstPtr scene = locked_scene;
+			if (!padded_scene || padded_scene->getParent() != scene || padded_trail != trail ||
+			    padded_generation != world_generation){
+				padded_scene = scene->diff();
+				padded_scene->getCollisionRobotNonConst()->setLinkPadding(trail->paddings);
+				padded_trail = trail;
+				padded_generation = world_generation;
+			}
+			event = check(*padded_scene, *trail, current_waypoint, checked_until, update_time);
+		}
+
+		lock.lock();
+		if (trail != trail_)
+			continue;
+		current_waypoint_ = current_waypoint;
+		if (world_generation == world_generation_)
+			checked_until_ = checked_until;
+		if (event.signal <= raised_signal_)
+			continue;
+		raised_signal_ = event.signal;
+		lock.unlock();
+		signal_callback_(event);
+		lock.lock();
+	}
+}
+
+MonitorEvent ExecutionMonitor::check(const planning_scene::PlanningScene& scene, const MonitoredTrail& trail,
+                                     size_t& current_waypoint, size_t& checked_until,
+                                     chrono::steady_clock::time_point update_time) const{
+	MonitorEvent event = {MONITOR_CLEAR, current_waypoint, trail.waypoints.size(), 0.0, 0, ""};
+	size_t horizon_end = min(trail.waypoints.size(), current_waypoint + config_.horizon);
+
+	//The robot only moves forward along the trail, the nearest waypoint of the horizon is the current one
+	Eigen::VectorXd positions(jmg_ptr_->getVariableCount());
+	scene.getCurrentState().copyJointGroupPositions(jmg_ptr_, positions.data());
+	if (horizon_end > current_waypoint){
+		Eigen::MatrixXd::Index nearest;
+		(trail.positions.middleCols(current_waypoint, horizon_end - current_waypoint).colwise() - positions)
+				.colwise().squaredNorm().minCoeff(&nearest);
+		current_waypoint += nearest;
+		horizon_end = min(trail.waypoints.size(), current_waypoint + config_.horizon);
+	}
+	event.current_waypoint = current_waypoint;
+
+	collision_detection::CollisionRequest request;
+	request.group_name = config_.planning_group;
+	for (size_t waypoint_idx = max(current_waypoint, checked_until); waypoint_idx < horizon_end; ++waypoint_idx){
+		collision_detection::CollisionResult result;
+		scene.getCollisionWorld()->checkRobotCollision(request, result, *scene.getCollisionRobot(),
+		                                               *trail.waypoints[waypoint_idx],
+		                                               scene.getAllowedCollisionMatrix());
+		event.collision_queries++;
+		event.latency_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - update_time).count();
+		if (result.collision){
+			event.signal = waypoint_idx - current_waypoint < config_.stop_waypoints ? MONITOR_STOP : MONITOR_REPLAN;
+			event.colliding_waypoint = waypoint_idx;
+			event.reason = "Waypoint " + to_string(waypoint_idx) + " collides with the world";
+			return event;
+		}
+		checked_until = waypoint_idx + 1;
+		if (event.latency_ms > config_.latency_budget_ms){
+			event.signal = MONITOR_STOP;
+			event.reason = "The horizon isn't checked within the latency budget";
+			return event;
+		}
+	}
+	event.latency_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - update_time).count();
+	return event;
+}
+
+}
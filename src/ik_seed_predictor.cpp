@@ -0,0 +1,107 @@
+#include <kinematics_test/ik_seed_predictor.h>
+
+#include <ros/ros.h>
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#define SEED_PREDICTOR_MAGIC "kinematics_test_seed_predictor"
+
+using namespace std;
+
+namespace kinematics_test {
+
+IkSeedPredictor::Statistics::Statistics() :
+		seeded_attempts(0), seeded_successes(0), fallback_attempts(0), fallback_successes(0), ik_nanoseconds(0){}
+
+IkSeedPredictor::IkSeedPredictor(){
+	memset(&weights, 0, sizeof(weights));
+	for (size_t i = 0; i < SEED_PREDICTOR_INPUTS; ++i)
+		weights.input_scale[i] = 1.0;
+}
+
+IkSeedPredictor::IkSeedPredictor(const string& path){
+	ifstream model(path.c_str());
+	string magic;
+	size_t inputs, hidden, joints;
+	if (!(model >> magic >> inputs >> hidden >> joints) || magic != SEED_PREDICTOR_MAGIC)
+		throw runtime_error("Can't read seed predictor " + path);
+	if (inputs != SEED_PREDICTOR_INPUTS || hidden != SEED_PREDICTOR_HIDDEN || joints != SEED_PREDICTOR_JOINTS)
+		throw runtime_error("Seed predictor " + path + " was trained for different sizes");
+
+	double* values = reinterpret_cast<double*>(&weights);
+	for (size_t i = 0; i < sizeof(weights) / sizeof(double); ++i)
+		if (!(model >> values[i]))
+			throw runtime_error("Seed predictor " + path + " is truncated");
+}
+
+void IkSeedPredictor::save(const string& path) const{
+	ofstream model(path.c_str());
+	model.precision(17);
+	model << SEED_PREDICTOR_MAGIC << " " << SEED_PREDICTOR_INPUTS << " " << SEED_PREDICTOR_HIDDEN << " "
+	      << SEED_PREDICTOR_JOINTS << "\n";
+	const double* values = reinterpret_cast<const double*>(&weights);
+	for (size_t i = 0; i < sizeof(weights) / sizeof(double); ++i)
+		model << values[i] << "\n";
+	if (!model)
+		throw runtime_error("Can't write seed predictor " + path);
+}
+
+void IkSeedPredictor::computeFeatures(const Eigen::Affine3d& current_pose, const Eigen::Affine3d& target_pose,
+                                      const double* joint_positions, double* features){
+	Eigen::Vector3d translation_step = target_pose.translation() - current_pose.translation();
+	Eigen::AngleAxisd rotation_step(target_pose.rotation() * current_pose.rotation().transpose());
+	Eigen::Vector3d rotation_vector = rotation_step.angle() * rotation_step.axis();
+
+	for (size_t i = 0; i < 3; ++i){
+		features[i] = translation_step[i];
+		features[3 + i] = rotation_vector[i];
+	}
+	for (size_t i = 0; i < SEED_PREDICTOR_JOINTS; ++i){
+		features[6 + 2 * i] = sin(joint_positions[i]);
+		features[7 + 2 * i] = cos(joint_positions[i]);
+	}
+}
+
+void IkSeedPredictor::forward(const double* normalized_features, double* hidden, double* step) const{
+	for (size_t h = 0; h < SEED_PREDICTOR_HIDDEN; ++h){
+		double activation = weights.hidden_bias[h];
+		for (size_t i = 0; i < SEED_PREDICTOR_INPUTS; ++i)
+			activation += weights.hidden_weights[h][i] * normalized_features[i];
+		hidden[h] = tanh(activation);
+	}
+	for (size_t j = 0; j < SEED_PREDICTOR_JOINTS; ++j){
+		double output = weights.output_bias[j];
+		for (size_t h = 0; h < SEED_PREDICTOR_HIDDEN; ++h)
+			output += weights.output_weights[j][h] * hidden[h];
+		step[j] = output;
+	}
+}
+
+void IkSeedPredictor::predict(const Eigen::Affine3d& current_pose, const Eigen::Affine3d& target_pose,
+                              const double* joint_positions, double* seed) const{
+	double features[SEED_PREDICTOR_INPUTS];
+	double hidden[SEED_PREDICTOR_HIDDEN];
+	double step[SEED_PREDICTOR_JOINTS];
+
+	computeFeatures(current_pose, target_pose, joint_positions, features);
+	for (size_t i = 0; i < SEED_PREDICTOR_INPUTS; ++i)
+		features[i] = (features[i] - weights.input_mean[i]) * weights.input_scale[i];
+	forward(features, hidden, step);
+
+	for (size_t j = 0; j < SEED_PREDICTOR_JOINTS; ++j)
+		seed[j] = joint_positions[j] + step[j];
+}
+
+void IkSeedPredictor::report() const{
+	uint64_t seeded_attempts = statistics.seeded_attempts.load();
+	uint64_t fallback_attempts = statistics.fallback_attempts.load();
+	ROS_INFO("Seeded IK: %lu of %lu solved, trac-ik fallback: %lu of %lu solved, mean IK time %.3f ms",
+	         (unsigned long)statistics.seeded_successes.load(), (unsigned long)seeded_attempts,
+	         (unsigned long)statistics.fallback_successes.load(), (unsigned long)fallback_attempts,
+	         seeded_attempts ? statistics.ik_nanoseconds.load() / 1e6 / seeded_attempts : 0.0);
+}
+
+}
@@ -0,0 +1,278 @@
+/*********************************************************************
+ * Offline training of the IK seed predictor. Samples are small random
+ * joint steps around random configurations, plus consecutive waypoints
+ * of the corpus moves when a corpus is given. The held-out samples are
+ * solved by trac-ik with and without the learned seed to measure the
+ * gain in IK time and success rate.
+ *
+ *   ik_seed_trainer <model_output> [--samples N] [--epochs E] [--corpus path]
+ *********************************************************************/
+
+#include <ros/ros.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <moveit/robot_model_loader/robot_model_loader.h>
+#include <moveit/planning_scene/planning_scene.h>
+#include <kinematics_test/cartesian_path_planner.h>
+#include <kinematics_test/ik_seed_predictor.h>
+#include <kinematics_test/request_corpus.h>
+
+#define DEFAULT_ROBOT_DESCRIPTION "robot_description"
+#define TRAINING_SAMPLES 200000
+#define TRAINING_EPOCHS 30
+#define TRAINING_BATCH 64
+#define TRAINING_LEARNING_RATE 0.001
+#define TRAINING_MAX_JOINT_STEP 0.05
+#define TRAINING_HOLDOUT_FRACTION 0.1
+#define EVALUATION_IK_SAMPLES 500
+#define USAGE "Usage: ik_seed_trainer <model_output> [--samples N] [--epochs E] [--corpus path]"
+
+using namespace std;
+using namespace moveit;
+using namespace core;
+using namespace kinematics_test;
+
+struct TrainingSample {
+	double features[SEED_PREDICTOR_INPUTS];
+	double step[SEED_PREDICTOR_JOINTS];
+	//Kept for the IK evaluation of held-out samples
+	double start_positions[SEED_PREDICTOR_JOINTS];
+	Eigen::Affine3d target_pose;
+};
+
+void addSample(vector<TrainingSample>& samples, robot_state::RobotState& state, robot_state::RobotState& next_state,
+               const robot_state::JointModelGroup* jmg_ptr, const robot_state::LinkModel* tip){
+	TrainingSample sample;
+	double next_positions[SEED_PREDICTOR_JOINTS];
+	state.copyJointGroupPositions(jmg_ptr, sample.start_positions);
+	next_state.copyJointGroupPositions(jmg_ptr, next_positions);
+	sample.target_pose = next_state.getGlobalLinkTransform(tip);
+	IkSeedPredictor::computeFeatures(state.getGlobalLinkTransform(tip), sample.target_pose,
+	                                 sample.start_positions, sample.features);
+	for (size_t j = 0; j < SEED_PREDICTOR_JOINTS; ++j)
+		sample.step[j] = next_positions[j] - sample.start_positions[j];
+	samples.push_back(sample);
+}
+
+/** Mean absolute error of the predicted joint step */
+double evaluate(const IkSeedPredictor& predictor, const vector<TrainingSample>& samples, size_t begin, size_t end){
+	double hidden[SEED_PREDICTOR_HIDDEN], step[SEED_PREDICTOR_JOINTS], features[SEED_PREDICTOR_INPUTS];
+	double error = 0;
+	for (size_t s = begin; s < end; ++s){
+		for (size_t i = 0; i < SEED_PREDICTOR_INPUTS; ++i)
+			features[i] = (samples[s].features[i] - predictor.weights.input_mean[i]) * predictor.weights.input_scale[i];
+		predictor.forward(features, hidden, step);
+		for (size_t j = 0; j < SEED_PREDICTOR_JOINTS; ++j)
+			error += fabs(step[j] - samples[s].step[j]);
+	}
+	return end > begin ? error / ((end - begin) * SEED_PREDICTOR_JOINTS) : 0.0;
+}
+
+/** Minibatch Adam on the mean squared joint step error */
+void train(IkSeedPredictor& predictor, vector<TrainingSample>& samples, size_t train_count, size_t epochs){
+	SeedPredictorWeights& weights = predictor.weights;
+	const size_t parameter_count = sizeof(SeedPredictorWeights) / sizeof(double);
+	//Normalization is not trained, the parameters start after it
+	const size_t first_parameter = 2 * SEED_PREDICTOR_INPUTS;
+	double* parameters = reinterpret_cast<double*>(&weights);
+	vector<double> gradient(parameter_count), first_moment(parameter_count, 0.0), second_moment(parameter_count, 0.0);
+	SeedPredictorWeights& gradient_weights = *reinterpret_cast<SeedPredictorWeights*>(gradient.data());
+
+	mt19937 generator(0);
+	normal_distribution<double> initial(0.0, 1.0 / sqrt((double)SEED_PREDICTOR_INPUTS));
+	for (size_t p = first_parameter; p < parameter_count; ++p)
+		parameters[p] = initial(generator) * 0.5;
+
+	size_t adam_step = 0;
+	for (size_t epoch = 0; epoch < epochs; ++epoch){
+		shuffle(samples.begin(), samples.begin() + train_count, generator);
+		for (size_t batch_start = 0; batch_start < train_count; batch_start += TRAINING_BATCH){
+			size_t batch_end = min(train_count, batch_start + TRAINING_BATCH);
+			fill(gradient.begin(), gradient.end(), 0.0);
+
+			for (size_t s = batch_start; s < batch_end; ++s){
+				double features[SEED_PREDICTOR_INPUTS], hidden[SEED_PREDICTOR_HIDDEN], step[SEED_PREDICTOR_JOINTS];
+				for (size_t i = 0; i < SEED_PREDICTOR_INPUTS; ++i)
+					features[i] = (samples[s].features[i] - weights.input_mean[i]) * weights.input_scale[i];
+				predictor.forward(features, hidden, step);
+
+				double hidden_error[SEED_PREDICTOR_HIDDEN] = {0};
+				for (size_t j = 0; j < SEED_PREDICTOR_JOINTS; ++j){
+					double output_error = 2.0 * (step[j] - samples[s].step[j]) / (batch_end - batch_start);
+					gradient_weights.output_bias[j] += output_error;
+					for (size_t h = 0; h < SEED_PREDICTOR_HIDDEN; ++h){
+						gradient_weights.output_weights[j][h] += output_error * hidden[h];
+						hidden_error[h] += output_error * weights.output_weights[j][h];
+					}
+				}
+				for (size_t h = 0; h < SEED_PREDICTOR_HIDDEN; ++h){
+					double activation_error = hidden_error[h] * (1.0 - hidden[h] * hidden[h]);
+					gradient_weights.hidden_bias[h] += activation_error;
+					for (size_t i = 0; i < SEED_PREDICTOR_INPUTS; ++i)
+						gradient_weights.hidden_weights[h][i] += activation_error * features[i];
+				}
+			}
+
+			adam_step++;
+			double first_correction = 1.0 - pow(0.9, adam_step);
+			double second_correction = 1.0 - pow(0.999, adam_step);
+			for (size_t p = first_parameter; p < parameter_count; ++p){
+				first_moment[p] = 0.9 * first_moment[p] + 0.1 * gradient[p];
+				second_moment[p] = 0.999 * second_moment[p] + 0.001 * gradient[p] * gradient[p];
+				parameters[p] -= TRAINING_LEARNING_RATE * (first_moment[p] / first_correction) /
+						(sqrt(second_moment[p] / second_correction) + 1e-8);
+			}
+		}
+		ROS_INFO("Epoch %lu: train error %.5f rad", epoch + 1, evaluate(predictor, samples, 0, train_count));
+	}
+}
+
+/** Solve held-out targets from the previous joints and from the learned seed */
+void evaluateIK(const IkSeedPredictor& predictor, const vector<TrainingSample>& samples, size_t begin,
+                robot_state::RobotState kinematic_state, const PlannerConfig& config){
+	const robot_state::JointModelGroup* jmg_ptr = kinematic_state.getJointModelGroup(config.planning_group);
+	const robot_state::LinkModel* tip = kinematic_state.getLinkModel(config.end_effector);
+	size_t end = min(samples.size(), begin + EVALUATION_IK_SAMPLES);
+	size_t plain_solved = 0, seeded_solved = 0;
+	double plain_ms = 0, seeded_ms = 0;
+
+	for (size_t s = begin; s < end; ++s){
+		kinematic_state.setJointGroupPositions(jmg_ptr, samples[s].start_positions);
+		chrono::steady_clock::time_point ik_start = chrono::steady_clock::now();
+		plain_solved += kinematic_state.setFromIK(jmg_ptr, samples[s].target_pose, tip->getName());
+		plain_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - ik_start).count();
+
+		double seed[SEED_PREDICTOR_JOINTS];
+		kinematic_state.setJointGroupPositions(jmg_ptr, samples[s].start_positions);
+		ik_start = chrono::steady_clock::now();
+		predictor.predict(kinematic_state.getGlobalLinkTransform(tip), samples[s].target_pose,
+		                  samples[s].start_positions, seed);
+		kinematic_state.setJointGroupPositions(jmg_ptr, seed);
+		kinematic_state.enforceBounds(jmg_ptr);
+		seeded_solved += kinematic_state.setFromIK(jmg_ptr, samples[s].target_pose, tip->getName(), 1,
+		                                           config.seeded_ik_timeout);
+		seeded_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - ik_start).count();
+	}
+
+	size_t count = max((size_t)1, end - begin);
+	ROS_INFO("trac-ik from previous joints: %.1f%% solved, %.3f ms mean", 100.0 * plain_solved / count, plain_ms / count);
+	ROS_INFO("trac-ik from learned seed:    %.1f%% solved, %.3f ms mean", 100.0 * seeded_solved / count, seeded_ms / count);
+}
+
+/** Throws runtime_error on a value that isn't a positive whole number */
+size_t parseCount(const string& value){
+	size_t parsed_length = 0;
+	unsigned long count = 0;
+	try {
+		count = stoul(value, &parsed_length);
+	}
+	catch (const logic_error&){
+		parsed_length = 0;
+	}
+	//stoul accepts a leading minus and wraps it around
+	if (parsed_length == 0 || parsed_length != value.size() || value[0] == '-' || count == 0)
+		throw runtime_error("Bad count \"" + value + "\"");
+	return count;
+}
+
+int main(int argc, char** argv)
+{
+	ros::init(argc, argv, "ik_seed_trainer");
+	if (argc < 2){
+		fprintf(stderr, "%s\n", USAGE);
+		return 1;
+	}
+	string model_path = argv[1];
+	string corpus_path;
+	size_t sample_count = TRAINING_SAMPLES, epochs = TRAINING_EPOCHS;
+	try {
+		for (int arg_idx = 2; arg_idx < argc; arg_idx += 2){
+			string option = argv[arg_idx];
+			if (arg_idx + 1 == argc)
+				throw runtime_error("Option " + option + " needs a value");
+			if (option == "--samples")
+				sample_count = parseCount(argv[arg_idx + 1]);
+			else if (option == "--epochs")
+				epochs = parseCount(argv[arg_idx + 1]);
+			else if (option == "--corpus")
+				corpus_path = argv[arg_idx + 1];
+			else
+				throw runtime_error("Unknown option " + option);
+		}
+	}
+	catch (const runtime_error& error){
+		fprintf(stderr, "%s\n%s\n", error.what(), USAGE);
+		return 1;
+	}
+
+	ros::NodeHandle node_handle;
+	robot_model_loader::RobotModelLoader kt_robot_model_loader(DEFAULT_ROBOT_DESCRIPTION);
+	robot_model::RobotModelConstPtr kt_kinematic_model = kt_robot_model_loader.getModel();
+	PlannerConfig config;
+	const robot_state::JointModelGroup* jmg_ptr = kt_kinematic_model->getJointModelGroup(config.planning_group);
+	const robot_state::LinkModel* tip = kt_kinematic_model->getLinkModel(config.end_effector);
+	if (jmg_ptr->getVariableCount() != SEED_PREDICTOR_JOINTS){
+		ROS_ERROR("The seed predictor is built for %d joints", SEED_PREDICTOR_JOINTS);
+		return 1;
+	}
+
+	//Workload generator: small random joint steps around random configurations
+	vector<TrainingSample> samples;
+	samples.reserve(sample_count);
+	robot_state::RobotState state(kt_kinematic_model), next_state(kt_kinematic_model);
+	mt19937 generator(1);
+	uniform_real_distribution<double> joint_step(-TRAINING_MAX_JOINT_STEP, TRAINING_MAX_JOINT_STEP);
+	for (size_t s = 0; s < sample_count; ++s){
+		state.setToRandomPositions(jmg_ptr);
+		double positions[SEED_PREDICTOR_JOINTS];
+		state.copyJointGroupPositions(jmg_ptr, positions);
+		for (size_t j = 0; j < SEED_PREDICTOR_JOINTS; ++j)
+			positions[j] += joint_step(generator);
+		next_state = state;
+		next_state.setJointGroupPositions(jmg_ptr, positions);
+		next_state.enforceBounds(jmg_ptr);
+		addSample(samples, state, next_state, jmg_ptr, tip);
+	}
+
+	//Recorded moves: the steps the pipeline actually takes
+	if (!corpus_path.empty()){
+		planning_scene::PlanningScenePtr kt_planning_scene(new planning_scene::PlanningScene(kt_kinematic_model));
+		CartesianPathPlanner planner(kt_kinematic_model, kt_planning_scene, config);
+		robot_state::RobotState start_state(kt_kinematic_model);
+		setToStartState(start_state, config);
+		for (const PlanningRequest& request : loadRequestCorpus(corpus_path)){
+			Trail trail;
+			if (!planner.plan(trail, start_state, request.goal_transform, request.global_reference_frame))
+				continue;
+			for (Trail::iterator it = trail.begin(); it != --trail.end(); ++it)
+				addSample(samples, **it, **next(it), jmg_ptr, tip);
+		}
+	}
+	shuffle(samples.begin(), samples.end(), generator);
+	size_t train_count = samples.size() - (size_t)(samples.size() * TRAINING_HOLDOUT_FRACTION);
+	ROS_INFO("Training on %lu samples, %lu held out", train_count, samples.size() - train_count);
+
+	IkSeedPredictor predictor;
+	for (size_t i = 0; i < SEED_PREDICTOR_INPUTS; ++i){
+		double mean = 0, variance = 0;
+		for (size_t s = 0; s < train_count; ++s)
+			mean += samples[s].features[i];
+		mean /= train_count;
+		for (size_t s = 0; s < train_count; ++s)
+			variance += pow(samples[s].features[i] - mean, 2);
+		predictor.weights.input_mean[i] = mean;
+		predictor.weights.input_scale[i] = 1.0 / sqrt(variance / train_count + 1e-12);
+	}
+
+	train(predictor, samples, train_count, epochs);
+	ROS_INFO("Held-out error %.5f rad", evaluate(predictor, samples, train_count, samples.size()));
+	evaluateIK(predictor, samples, train_count, state, config);
+
+	predictor.save(model_path);
+	ROS_INFO("Seed predictor written to %s", model_path.c_str());
+	return 0;
+}
@@ -0,0 +1,136 @@
+#include <kinematics_test/link_transform_table.h>
+
+#include <algorithm>
+#include <cmath>
+#include <geometric_shapes/shape_operations.h>
+
+using namespace std;
+using namespace moveit;
+using namespace core;
+
+namespace kinematics_test {
+
+namespace {
+
+thread_local LinkTransformTable* current_transforms = nullptr;
+
+//Columns of the first waypoints, the table doubles from there
+const size_t INITIAL_WAYPOINT_CAPACITY = 64;
+
+}
+
+LinkTransformTable::LinkTransformTable(const robot_state::JointModelGroup* jmg_ptr,
+                                       const vector<const robot_state::LinkModel*>& links) :
+		jmg_ptr_(jmg_ptr), links_(links), recent_states_{nullptr, nullptr}, recent_indices_{0, 0}{
+	link_diagonals_.resize(links_.size());
+	for (size_t link_idx = 0; link_idx < links_.size(); ++link_idx){
+		Eigen::Vector3d link_extends = shapes::computeShapeExtents(links_[link_idx]->getShapes()[0].get());
+		link_diagonals_[link_idx] = sqrt(pow(link_extends[0], 2) + pow(link_extends[1], 2) + pow(link_extends[2], 2));
+	}
+	reserve(INITIAL_WAYPOINT_CAPACITY);
+}
+
+int LinkTransformTable::linkIndex(const robot_state::LinkModel* link) const{
+	vector<const robot_state::LinkModel*>::const_iterator found = find(links_.begin(), links_.end(), link);
+	return found == links_.end() ? -1 : found - links_.begin();
+}
+
+void LinkTransformTable::reserve(size_t waypoint_count){
+	joint_positions_.conservativeResize(jmg_ptr_->getVariableCount(), waypoint_count);
+	translations_.conservativeResize(Eigen::NoChange, waypoint_count * links_.size());
+	orientations_.conservativeResize(Eigen::NoChange, waypoint_count * links_.size());
+}
+
+void LinkTransformTable::remember(const robot_state::RobotState* state, size_t waypoint_idx){
+	if (recent_states_[0] == state)
+		return;
+	recent_states_[1] = recent_states_[0];
+	recent_indices_[1] = recent_indices_[0];
+	recent_states_[0] = state;
+	recent_indices_[0] = waypoint_idx;
+}
+
+size_t LinkTransformTable::waypoint(const robot_state::RobotStatePtr& state){
+	size_t waypoint_idx;
+	bool cached = true;
+	if (recent_states_[0] == state.get())
+		waypoint_idx = recent_indices_[0];
+	else if (recent_states_[1] == state.get())
+		waypoint_idx = recent_indices_[1];
+	else {
+		unordered_map<const robot_state::RobotState*, size_t>::const_iterator known = indices_.find(state.get());
+		if (known != indices_.end())
+			waypoint_idx = known->second;
+		else {
+			cached = false;
+			waypoint_idx = states_.size();
+			if (waypoint_idx == (size_t)joint_positions_.cols())
+				reserve(2 * waypoint_idx);
+			indices_[state.get()] = waypoint_idx;
+			states_.push_back(state);
+		}
+	}
+	remember(state.get(), waypoint_idx);
+
+	if (cached){
+		const vector<int>& variable_indices = jmg_ptr_->getVariableIndexList();
+		size_t variable_idx = 0;
+		while (variable_idx < variable_indices.size() &&
+		       state->getVariablePosition(variable_indices[variable_idx]) == joint_positions_(variable_idx, waypoint_idx))
+			variable_idx++;
+		if (variable_idx == variable_indices.size())
+			return waypoint_idx;
+	}
+
+	state->update();
+	state->copyJointGroupPositions(jmg_ptr_, joint_positions_.col(waypoint_idx).data());
+	for (size_t link_idx = 0; link_idx < links_.size(); ++link_idx){
+		const Eigen::Affine3d& link_transform = state->getGlobalLinkTransform(links_[link_idx]);
+		translations_.col(waypoint_idx * links_.size() + link_idx) = link_transform.translation();
+		orientations_.col(waypoint_idx * links_.size() + link_idx) =
+				Eigen::Quaterniond(link_transform.rotation()).coeffs();
+	}
+	return waypoint_idx;
+}
+
+Eigen::Affine3d LinkTransformTable::transform(size_t waypoint_idx, size_t link_idx) const{
+	Eigen::Vector4d coefficients = orientation(waypoint_idx, link_idx);
+	Eigen::Affine3d link_transform(Eigen::Quaterniond(coefficients[3], coefficients[0], coefficients[1],
+	                                                  coefficients[2]));
+	link_transform.translation() = translation(waypoint_idx, link_idx);
+	return link_transform;
+}
+
+double LinkTransformTable::fullTranslation(size_t waypoint_idx, size_t next_waypoint_idx, size_t link_idx) const{
+	Eigen::Vector4d coefficients = orientation(waypoint_idx, link_idx);
+	Eigen::Vector4d next_coefficients = orientation(next_waypoint_idx, link_idx);
+	Eigen::Quaterniond start_quaternion(coefficients[3], coefficients[0], coefficients[1], coefficients[2]);
+	Eigen::Quaterniond target_quaternion(next_coefficients[3], next_coefficients[0], next_coefficients[1],
+	                                     next_coefficients[2]);
+	Eigen::Vector3d start_translation = translation(waypoint_idx, link_idx);
+
+	//Same arithmetic as getFullTranslation, so cached and uncached passes insert the same waypoints
+	return fullTranslationBound((start_translation - translation(next_waypoint_idx, link_idx)).norm(),
+	                            start_translation.norm(), link_diagonals_[link_idx],
+	                            start_quaternion.angularDistance(target_quaternion));
+}
+
+void LinkTransformTable::clear(){
+	states_.clear();
+	indices_.clear();
+	recent_states_[0] = recent_states_[1] = nullptr;
+}
+
+LinkTransformScope::LinkTransformScope(LinkTransformTable* transforms) : previous_(current_transforms){
+	current_transforms = transforms;
+}
+
+LinkTransformScope::~LinkTransformScope(){
+	current_transforms = previous_;
+}
+
+LinkTransformTable* LinkTransformScope::current(){
+	return current_transforms;
+}
+
+}
@@ -0,0 +1,89 @@
+#include <kinematics_test/memory_accounting.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <malloc.h>
+#include <sys/resource.h>
+
+using namespace std;
+
+namespace kinematics_test {
+
+namespace {
+
+//Plain thread-locals, operator new must not allocate to reach them
+thread_local RequestMemory* current_request = nullptr;
+thread_local PipelineStage current_stage = STAGE_COUNT;
+atomic<bool> accounting_installed(false);
+
+}
+
+RequestMemory::RequestMemory(uint64_t budget_bytes) :
+		budget_bytes(budget_bytes), allocations(0), allocated_bytes(0), live_bytes(0), peak_live_bytes(0),
+		budget_exceeded(false), peak_rss_bytes(0){
+	for (atomic<uint64_t>& bytes : stage_bytes)
+		bytes.store(0, memory_order_relaxed);
+}
+
+void RequestMemory::onAllocate(uint64_t bytes, PipelineStage stage){
+	allocations.fetch_add(1, memory_order_relaxed);
+	allocated_bytes.fetch_add(bytes, memory_order_relaxed);
+	stage_bytes[stage].fetch_add(bytes, memory_order_relaxed);
+
+	int64_t live = live_bytes.fetch_add(bytes, memory_order_relaxed) + bytes;
+	int64_t peak = peak_live_bytes.load(memory_order_relaxed);
+	while (live > peak && !peak_live_bytes.compare_exchange_weak(peak, live, memory_order_relaxed));
+	if (budget_bytes && live > (int64_t)budget_bytes)
+		budget_exceeded.store(true, memory_order_relaxed);
+}
+
+void RequestMemory::onFree(uint64_t bytes){
+	live_bytes.fetch_sub(bytes, memory_order_relaxed);
+}
+
+void RequestMemory::checkBudget() const{
+	if (budget_exceeded.load(memory_order_relaxed))
+		throw runtime_error("Memory budget exceeded!");
+}
+
+MemoryRequestScope::MemoryRequestScope(RequestMemory* memory) : previous_(current_request){
+	current_request = memory;
+}
+
+MemoryRequestScope::~MemoryRequestScope(){
+	current_request = previous_;
+}
+
+RequestMemory* MemoryRequestScope::current(){
+	return current_request;
+}
+
+PipelineStage& currentMemoryStage(){
+	return current_stage;
+}
+
+void accountAllocation(void* ptr){
+	if (current_request)
+		current_request->onAllocate(malloc_usable_size(ptr), current_stage);
+}
+
+void accountFree(void* ptr){
+	if (current_request)
+		current_request->onFree(malloc_usable_size(ptr));
+}
+
+void installAllocationAccounting(){
+	accounting_installed.store(true, memory_order_relaxed);
+}
+
+bool isAllocationAccountingInstalled(){
+	return accounting_installed.load(memory_order_relaxed);
+}
+
+uint64_t getPeakRssBytes(){
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (uint64_t)usage.ru_maxrss * 1024;
+}
+
+}
@@ -0,0 +1,226 @@
+/*********************************************************************
+ * Replays a request corpus over a grid of planner parameters and
+ * reports the Pareto front of planning time, waypoint count, success
+ * rate and validity margin. The margin is the smallest clearance of any
+ * waypoint minus the distance a link may travel between two waypoints,
+ * a lower bound of the clearance along the whole executed path. It's
+ * measured against the world of the cell, loaded from a .scene file.
+ * Every grid point is checked like the parameters of the server.
+ *
+ *   parameter_tuner <corpus> <report.csv> --scene file [--steps a,b,..] [--distances a,b,..]
+ *                   [--attempts a,b,..] [--timeouts a,b,..]
+ *********************************************************************/
+
+#include <ros/ros.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <moveit/robot_model_loader/robot_model_loader.h>
+#include <moveit/planning_scene/planning_scene.h>
+#include <kinematics_test/cartesian_path_planner.h>
+#include <kinematics_test/request_corpus.h>
+#include <kinematics_test/startup_loading.h>
+
+#define DEFAULT_ROBOT_DESCRIPTION "robot_description"
+
+using namespace std;
+using namespace moveit;
+using namespace core;
+using namespace kinematics_test;
+
+struct TuningResult {
+	PlannerConfig config;
+	double planning_ms;
+	double mean_waypoints;
+	double success_rate;
+	double validity_margin;
+	bool pareto;
+};
+
+/** Throws runtime_error on a value that isn't a number */
+vector<double> parseGrid(const string& values){
+	vector<double> grid;
+	istringstream fields(values);
+	string value;
+	while (getline(fields, value, ',')){
+		size_t parsed_length = 0;
+		try {
+			grid.push_back(stod(value, &parsed_length));
+		}
+		catch (const logic_error&){
+			parsed_length = 0;
+		}
+		if (parsed_length == 0 || parsed_length != value.size())
+			throw runtime_error("Bad grid value \"" + value + "\" in " + values);
+	}
+	if (grid.empty())
+		throw runtime_error("Empty grid " + values);
+	return grid;
+}
+
+TuningResult replayCorpus(const vector<PlanningRequest>& requests, const robot_model::RobotModelConstPtr& kinematic_model,
+                          const planning_scene::PlanningScenePtr& current_scene, const PlannerConfig& config){
+	CartesianPathPlanner planner(kinematic_model, current_scene, config);
+	robot_state::RobotState start_state(kinematic_model);
+	setToStartState(start_state, config);
+
+	TuningResult result = {config, 0.0, 0.0, 0.0, numeric_limits<double>::infinity(), false};
+	size_t succeeded = 0, waypoints = 0;
+	for (const PlanningRequest& request : requests){
+		Trail trail;
+		RequestSeeds seeds(request.id);
+		SeedRequestScope seed_scope(&seeds);
+		chrono::steady_clock::time_point plan_start = chrono::steady_clock::now();
+		bool is_planned = planner.plan(trail, start_state, request.goal_transform, request.global_reference_frame,
+		                               request.path_policy);
+		result.planning_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - plan_start).count();
+		if (!is_planned)
+			continue;
+
+		succeeded++;
+		waypoints += trail.size();
+		for (const robot_state::RobotStatePtr& state : trail)
+			result.validity_margin = min(result.validity_margin,
+			                             current_scene->distanceToCollision(*state) - config.distance_constraint);
+	}
+	//Nothing planned, nothing was measured: no margin rather than an infinite one
+	if (succeeded == 0)
+		result.validity_margin = -numeric_limits<double>::infinity();
+	result.mean_waypoints = succeeded ? (double)waypoints / succeeded : 0.0;
+	result.success_rate = requests.empty() ? 0.0 : (double)succeeded / requests.size();
+	return result;
+}
+
+/** Faster, fewer waypoints, more successes and a larger margin are all better */
+bool dominates(const TuningResult& a, const TuningResult& b){
+	bool no_worse = a.planning_ms <= b.planning_ms && a.mean_waypoints <= b.mean_waypoints &&
+			a.success_rate >= b.success_rate && a.validity_margin >= b.validity_margin;
+	bool better = a.planning_ms < b.planning_ms || a.mean_waypoints < b.mean_waypoints ||
+			a.success_rate > b.success_rate || a.validity_margin > b.validity_margin;
+	return no_worse && better;
+}
+
+int main(int argc, char** argv)
+{
+	ros::init(argc, argv, "parameter_tuner");
+	if (argc < 3){
+		fprintf(stderr, "Usage: parameter_tuner <corpus> <report.csv> --scene file [--steps a,b,..] [--distances a,b,..]\n"
+		                "                       [--attempts a,b,..] [--timeouts a,b,..]\n");
+		return 1;
+	}
+
+	vector<double> steps = {0.005, 0.01, 0.02, 0.04};
+	vector<double> distances = {0.005, 0.01, 0.02};
+	vector<double> attempts = {EXPERIMENTAL_ATTEMPT_NUMBER};
+	vector<double> timeouts = {DEFAULT_IK_TIMEOUT, 0.01, 0.05};
+	string scene_path;
+	try {
+		for (int arg_idx = 3; arg_idx < argc; arg_idx += 2){
+			string option = argv[arg_idx];
+			if (arg_idx + 1 == argc)
+				throw runtime_error("Option " + option + " needs a value");
+			if (option == "--steps")
+				steps = parseGrid(argv[arg_idx + 1]);
+			else if (option == "--distances")
+				distances = parseGrid(argv[arg_idx + 1]);
+			else if (option == "--attempts")
+				attempts = parseGrid(argv[arg_idx + 1]);
+			else if (option == "--timeouts")
+				timeouts = parseGrid(argv[arg_idx + 1]);
+			else if (option == "--scene")
+				scene_path = argv[arg_idx + 1];
+			else
+				throw runtime_error("Unknown option " + option);
+		}
+		//Against an empty world every margin is the same, the tuner would rank on the other three alone
+		if (scene_path.empty())
+			throw runtime_error("The validity margin needs the cell, give it with --scene");
+		for (double attempt_number : attempts)
+			if (attempt_number != floor(attempt_number))
+				throw runtime_error("attempt_number " + to_string(attempt_number) + " isn't a whole number");
+	}
+	catch (const runtime_error& error){
+		fprintf(stderr, "%s\n", error.what());
+		return 1;
+	}
+
+	vector<PlanningRequest> requests = loadRequestCorpus(argv[1]);
+	ros::NodeHandle node_handle;
+	robot_model_loader::RobotModelLoader kt_robot_model_loader(DEFAULT_ROBOT_DESCRIPTION);
+	robot_model::RobotModelConstPtr kt_kinematic_model = kt_robot_model_loader.getModel();
+	planning_scene::PlanningScenePtr kt_planning_scene(new planning_scene::PlanningScene(kt_kinematic_model));
+	loadSceneGeometry(*kt_planning_scene, scene_path);
+
+	//The base configuration comes from the parameter server, the grid overrides four of its fields
+	PlannerConfig base_config;
+	loadPlannerConfig(ros::NodeHandle("~"), base_config);
+	CartesianPathPlanner(kt_kinematic_model, kt_planning_scene, base_config).warmUp(
+			robot_state::RobotState(kt_kinematic_model));
+
+	//The whole grid is checked before the first replay, a bad value doesn't end a long run halfway
+	vector<PlannerConfig> grid;
+	for (double step : steps)
+		for (double distance : distances)
+			for (double attempt_number : attempts)
+				for (double timeout : timeouts){
+					PlannerConfig config = base_config;
+					config.interpolation_step = step;
+					config.distance_constraint = distance;
+					config.attempt_number = max(0.0, attempt_number);
+					config.ik_timeout = timeout;
+					try {
+						validatePlannerConfig(config, "the grid");
+					}
+					catch (const runtime_error& error){
+						fprintf(stderr, "%s: step %g, distance %g, attempts %g, timeout %g\n", error.what(), step,
+						        distance, attempt_number, timeout);
+						return 1;
+					}
+					grid.push_back(config);
+				}
+
+	vector<TuningResult> results;
+	for (const PlannerConfig& config : grid){
+		results.push_back(replayCorpus(requests, kt_kinematic_model, kt_planning_scene, config));
+		ROS_INFO("step %.4f, distance %.4f, attempts %lu, timeout %.3f: %.1f ms, %.1f waypoints, "
+		         "%.0f%% success, margin %.4f", config.interpolation_step, config.distance_constraint,
+		         config.attempt_number, config.ik_timeout, results.back().planning_ms, results.back().mean_waypoints,
+		         100 * results.back().success_rate, results.back().validity_margin);
+	}
+
+	//A config that solves nothing can't be traded off against the others, its zero time and waypoints would win
+	for (TuningResult& candidate : results){
+		candidate.pareto = candidate.success_rate > 0.0;
+		if (!candidate.pareto)
+			continue;
+		for (const TuningResult& other : results)
+			if (other.success_rate > 0.0 && dominates(other, candidate)){
+				candidate.pareto = false;
+				break;
+			}
+	}
+
+	ofstream report(argv[2]);
+	report << "interpolation_step,distance_constraint,attempt_number,ik_timeout,"
+	          "planning_ms,mean_waypoints,success_rate,validity_margin,pareto\n";
+	for (const TuningResult& result : results)
+		report << result.config.interpolation_step << "," << result.config.distance_constraint << ","
+		       << result.config.attempt_number << "," << result.config.ik_timeout << "," << result.planning_ms << ","
+		       << result.mean_waypoints << "," << result.success_rate << "," << result.validity_margin << ","
+		       << result.pareto << "\n";
+
+	printf("Pareto front:\n");
+	for (const TuningResult& result : results)
+		if (result.pareto)
+			printf("  interpolation_step: %g, distance_constraint: %g, attempt_number: %lu, ik_timeout: %g"
+			       "  -> %.1f ms, %.1f waypoints, %.0f%% success, margin %.4f\n",
+			       result.config.interpolation_step, result.config.distance_constraint, result.config.attempt_number,
+			       result.config.ik_timeout, result.planning_ms, result.mean_waypoints, 100 * result.success_rate,
+			       result.validity_margin);
+	return 0;
+}
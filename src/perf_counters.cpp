@@ -0,0 +1,266 @@
+#include <kinematics_test/perf_counters.h>
+#include <kinematics_test/memory_accounting.h>
+
+#include <ros/ros.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace kinematics_test {
+
+namespace {
+
+const uint64_t counter_configs[COUNTER_COUNT] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES,
+	PERF_COUNT_HW_BRANCH_MISSES
+};
+
+struct GroupReading {
+	uint64_t counter_count;
+	uint64_t values[COUNTER_COUNT];
+};
+
+/** Threads of one label, the live ones and the exited ones */
+struct PerfAggregate {
+	PerfAggregate() : thread_count(0), has_counters(false){
+		memset(stages, 0, sizeof(stages));
+	}
+
+	void add(const ThreadPerfStatistics& statistics){
+		thread_count++;
+		has_counters |= statistics.has_counters;
+		for (size_t stage = 0; stage < STAGE_COUNT; ++stage){
+			StageSample sample = statistics.getSample((PipelineStage)stage);
+			stages[stage].calls += sample.calls;
+			stages[stage].nanoseconds += sample.nanoseconds;
+			for (size_t counter = 0; counter < COUNTER_COUNT; ++counter)
+				stages[stage].counters[counter] += sample.counters[counter];
+		}
+	}
+
+	size_t thread_count;
+	bool has_counters;
+	StageSample stages[STAGE_COUNT];
+};
+
+mutex registry_mutex;
+vector<shared_ptr<ThreadPerfStatistics>> live_threads;
+map<string, PerfAggregate> exited_threads;
+
+/** perf_event_open group of the calling thread, opened on its first scope */
+struct ThreadCounters {
+	ThreadCounters(){
+		for (int& fd : fds)
+			fd = -1;
+	}
+	//Thread-locals of a thread go before the statics, the registry is still there
+	~ThreadCounters(){
+		for (int fd : fds)
+			if (fd >= 0)
+				close(fd);
+		if (!statistics)
+			return;
+		lock_guard<mutex> lock(registry_mutex);
+		exited_threads[statistics->thread_label].add(*statistics);
+		live_threads.erase(find(live_threads.begin(), live_threads.end(), statistics));
+	}
+
+	bool open(){
+		for (size_t i = 0; i < COUNTER_COUNT; ++i){
+			perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = counter_configs[i];
+			attr.disabled = i == 0;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_GROUP;
+			fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds[0], 0);
+			//A partial group would shift the values, so it is all or nothing
+			if (fds[i] < 0){
+				for (int& fd : fds)
+					if (fd >= 0){
+						close(fd);
+						fd = -1;
+					}
+				return false;
+			}
+		}
+		ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		return true;
+	}
+
+	bool read(uint64_t* values) const{
+		GroupReading reading;
+		if (fds[0] < 0 || ::read(fds[0], &reading, sizeof(reading)) != sizeof(reading))
+			return false;
+		memcpy(values, reading.values, sizeof(reading.values));
+		return true;
+	}
+
+	int fds[COUNTER_COUNT];
+	shared_ptr<ThreadPerfStatistics> statistics;
+};
+
+thread_local ThreadCounters thread_counters;
+atomic<bool> permission_warned(false);
+
+uint64_t nowNanoseconds(){
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
+
+atomic<bool> PerfCounters::enabled_(false);
+
+ThreadPerfStatistics::ThreadPerfStatistics(const string& thread_label, bool has_counters) :
+		thread_label(thread_label), has_counters(has_counters){
+	clear();
+}
+
+void ThreadPerfStatistics::add(PipelineStage stage, uint64_t nanoseconds, const uint64_t* counters){
+	calls_[stage].fetch_add(1, memory_order_relaxed);
+	nanoseconds_[stage].fetch_add(nanoseconds, memory_order_relaxed);
+	if (counters)
+		for (size_t counter = 0; counter < COUNTER_COUNT; ++counter)
+			counters_[stage][counter].fetch_add(counters[counter], memory_order_relaxed);
+}
+
+StageSample ThreadPerfStatistics::getSample(PipelineStage stage) const{
+	StageSample sample;
+	sample.calls = calls_[stage].load(memory_order_relaxed);
+	sample.nanoseconds = nanoseconds_[stage].load(memory_order_relaxed);
+	for (size_t counter = 0; counter < COUNTER_COUNT; ++counter)
+		sample.counters[counter] = counters_[stage][counter].load(memory_order_relaxed);
+	return sample;
+}
+
+void ThreadPerfStatistics::clear(){
+	for (size_t stage = 0; stage < STAGE_COUNT; ++stage){
+		calls_[stage].store(0, memory_order_relaxed);
+		nanoseconds_[stage].store(0, memory_order_relaxed);
+		for (size_t counter = 0; counter < COUNTER_COUNT; ++counter)
+			counters_[stage][counter].store(0, memory_order_relaxed);
+	}
+}
+
+void PerfCounters::enable(){
+	enabled_.store(true, memory_order_relaxed);
+}
+
+bool PerfCounters::isEnabled(){
+	return enabled_.load(memory_order_relaxed);
+}
+
+void PerfCounters::reset(){
+	lock_guard<mutex> lock(registry_mutex);
+	for (shared_ptr<ThreadPerfStatistics>& statistics : live_threads)
+		statistics->clear();
+	exited_threads.clear();
+}
+
+const char* PerfCounters::stageName(PipelineStage stage){
+	switch (stage){
+		case STAGE_INTERPOLATION:
+			return "interpolation";
+		case STAGE_LINK_DISTANCE:
+			return "link_distance";
+		case STAGE_COLLISION:
+			return "collision";
+		case STAGE_ANALYTICS:
+			return "analytics";
+		case STAGE_PADDED_COLLISION:
+			return "padded_collision";
+		case STAGE_RESAMPLING:
+			return "resampling";
+		case STAGE_COUNT:
+			return "other";
+		default:
+			return "unknown";
+	}
+}
+
+void PerfCounters::report(){
+	//Short-lived workers are folded together by the stage they were started for
+	map<string, PerfAggregate> threads;
+	{
+		lock_guard<mutex> lock(registry_mutex);
+		threads = exited_threads;
+		for (const shared_ptr<ThreadPerfStatistics>& statistics : live_threads)
+			threads[statistics->thread_label].add(*statistics);
+	}
+
+	for (const pair<const string, PerfAggregate>& entry : threads)
+		for (size_t stage = 0; stage < STAGE_COUNT; ++stage){
+			const StageSample& sample = entry.second.stages[stage];
+			if (!sample.calls)
+				continue;
+			if (!entry.second.has_counters){
+				ROS_INFO("%s (%lu threads) %s: %lu calls, %.3f ms", entry.first.c_str(), entry.second.thread_count,
+				         stageName((PipelineStage)stage), (unsigned long)sample.calls, sample.nanoseconds / 1e6);
+				continue;
+			}
+			double cycles = sample.counters[COUNTER_CYCLES];
+			double instructions = sample.counters[COUNTER_INSTRUCTIONS];
+			ROS_INFO("%s (%lu threads) %s: %lu calls, %.3f ms, %.0f cycles, IPC %.2f, "
+			         "cache misses %lu (%.2f per kinstr), branch misses %lu (%.2f per kinstr)",
+			         entry.first.c_str(), entry.second.thread_count, stageName((PipelineStage)stage),
+			         (unsigned long)sample.calls, sample.nanoseconds / 1e6, cycles,
+			         cycles > 0 ? instructions / cycles : 0.0,
+			         (unsigned long)sample.counters[COUNTER_CACHE_MISSES],
+			         instructions > 0 ? 1000.0 * sample.counters[COUNTER_CACHE_MISSES] / instructions : 0.0,
+			         (unsigned long)sample.counters[COUNTER_BRANCH_MISSES],
+			         instructions > 0 ? 1000.0 * sample.counters[COUNTER_BRANCH_MISSES] / instructions : 0.0);
+		}
+}
+
+PerfStageScope::PerfStageScope(PipelineStage stage) :
+		stage_(stage), previous_stage_(currentMemoryStage()), active_(PerfCounters::isEnabled()){
+	currentMemoryStage() = stage;
+	if (!active_)
+		return;
+
+	if (!thread_counters.statistics){
+		bool has_counters = thread_counters.open();
+		if (!has_counters && !permission_warned.exchange(true))
+			ROS_WARN("perf_event_open is not permitted, only wall time is recorded. "
+			         "Check /proc/sys/kernel/perf_event_paranoid");
+		thread_counters.statistics.reset(new ThreadPerfStatistics(
+				string(PerfCounters::stageName(stage)) + " thread", has_counters));
+		lock_guard<mutex> lock(registry_mutex);
+		live_threads.push_back(thread_counters.statistics);
+	}
+	if (!thread_counters.read(start_counters_))
+		memset(start_counters_, 0, sizeof(start_counters_));
+	start_ns_ = nowNanoseconds();
+}
+
+PerfStageScope::~PerfStageScope(){
+	currentMemoryStage() = previous_stage_;
+	if (!active_)
+		return;
+
+	uint64_t end_ns = nowNanoseconds();
+	uint64_t counters[COUNTER_COUNT];
+	bool has_counters = thread_counters.read(counters);
+	if (has_counters)
+		for (size_t counter = 0; counter < COUNTER_COUNT; ++counter)
+			counters[counter] -= start_counters_[counter];
+	thread_counters.statistics->add(stage_, end_ns - start_ns_, has_counters ? counters : nullptr);
+}
+
+}
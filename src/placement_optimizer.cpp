@@ -0,0 +1,455 @@
+/*********************************************************************
+ * Searches where the part should sit relative to the robot. Every
+ * placement of a grid (position and yaw of the part frame in the model
+ * frame, the inverse of a robot base placement) is screened by worker
+ * threads with their own robot model and kinematics solvers:
+ *
+ *   - batch IK along every seam, sampled every SCREEN_STEP, each sample
+ *     seeded by the previous one. The entry of a seam is seeded by its
+ *     solution in the previous placement of the worker, a neighbour on
+ *     the grid, and by the start state if that misses
+ *   - the getFullTranslation bound of every refined link between two
+ *     samples, a bound over JUMP_DISTANCE is a branch flip
+ *   - a collision check of every sample against the cell of --scene
+ *
+ * A seam is reached if all of that passes. Placements are ranked by
+ * the number of reached seams first. Placements reaching as many seams
+ * are ordered by a score of the reached fraction, the minimum
+ * manipulability along them relative to the best placement, and the
+ * estimated cycle time per reached seam relative to the best placement. Cycle times are the
+ * joint space lower bound of sequence_optimizer with the seams welded
+ * in file order. The best placements are then planned through the full
+ * pipeline to confirm them, placements reaching no seam are never
+ * confirmed.
+ *
+ * The seam file is the one of sequence_optimizer, poses in the part frame.
+ * The cell is a .scene file in the model frame, without it only self
+ * collisions are checked.
+ *
+ *   placement_optimizer <seams> <placements.csv> [--workers N] [--grid x0,x1,y0,y1,z0,z1]
+ *                       [--step m] [--yaw-step rad] [--confirm K] [--weights manipulability,cycle]
+ *                       [--scene file]
+ *********************************************************************/
+
+#include <ros/ros.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <thread>
+#include <moveit/robot_model_loader/robot_model_loader.h>
+#include <moveit/planning_scene/planning_scene.h>
+#include <kinematics_test/cartesian_path_planner.h>
+#include <kinematics_test/startup_loading.h>
+
+#define DEFAULT_ROBOT_DESCRIPTION "robot_description"
+//Distance between two IK samples along a seam, m
+#define SCREEN_STEP 0.05
+//Greater link bound between two neighbouring samples is taken for a branch flip, m
+#define JUMP_DISTANCE 0.3
+#define DEFAULT_GRID_STEP 0.1
+#define DEFAULT_YAW_STEP (M_PI / 4)
+#define DEFAULT_CONFIRMED_PLACEMENTS 5
+#define DEFAULT_MANIPULABILITY_WEIGHT 0.2
+#define DEFAULT_CYCLE_WEIGHT 0.5
+//Used for joints without a velocity limit in the URDF, rad/s
+#define DEFAULT_JOINT_VELOCITY 1.0
+
+using namespace std;
+using namespace moveit;
+using namespace core;
+using namespace kinematics_test;
+
+typedef vector<double> JointPositions;
+
+struct Seam {
+	string id;
+	Eigen::Affine3d ends[2];
+};
+
+/** Planner of one worker thread, solvers can't be shared between threads */
+struct PlanningContext {
+	robot_model_loader::RobotModelLoaderPtr loader;
+	planning_scene::PlanningScenePtr scene;
+	unique_ptr<CartesianPathPlanner> planner;
+};
+
+struct Placement {
+	double x, y, z, yaw;
+
+	Eigen::Affine3d transform() const{
+		return Eigen::Translation3d(x, y, z) * Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitZ());
+	}
+};
+
+struct PlacementResult {
+	Placement placement;
+	size_t reached_seams;
+	double min_manipulability;
+	double cycle_seconds;
+	double score;
+	//-1 until the placement is planned through the pipeline
+	int planned_seams;
+};
+
+/** Joint positions where a seam is entered and left, reused as IK seeds by the next placement */
+struct SeamScreen {
+	bool reached;
+	JointPositions entry;
+	JointPositions exit;
+	double seconds;
+	double min_manipulability;
+};
+
+Eigen::Affine3d parsePose(istream& fields){
+	double x, y, z, roll, pitch, yaw;
+	if (!(fields >> x >> y >> z >> roll >> pitch >> yaw))
+		throw runtime_error("Malformed pose");
+	return Eigen::Translation3d(x, y, z) *
+			Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitZ()) *
+			Eigen::AngleAxisd(pitch, Eigen::Vector3d::UnitY()) *
+			Eigen::AngleAxisd(roll, Eigen::Vector3d::UnitX());
+}
+
+vector<Seam> loadSeams(const string& path){
+	ifstream file(path.c_str());
+	if (!file)
+		throw runtime_error("Can't open seam file " + path);
+	vector<Seam> seams;
+	string line;
+	while (getline(file, line)){
+		if (line.empty() || line[0] == '#')
+			continue;
+		istringstream fields(line);
+		Seam seam;
+		fields >> seam.id;
+		seam.ends[0] = parsePose(fields);
+		seam.ends[1] = parsePose(fields);
+		seams.push_back(seam);
+	}
+	return seams;
+}
+
+vector<double> parseList(const string& text){
+	vector<double> values;
+	istringstream fields(text);
+	string field;
+	while (getline(fields, field, ','))
+		if (!field.empty())
+			values.push_back(atof(field.c_str()));
+	return values;
+}
+
+vector<double> getMaxVelocities(const robot_state::JointModelGroup* jmg_ptr){
+	vector<double> velocities;
+	for (const robot_state::JointModel* joint : jmg_ptr->getActiveJointModels())
+		for (const robot_state::VariableBounds& bounds : joint->getVariableBounds())
+			velocities.push_back(bounds.velocity_bounded_ && bounds.max_velocity_ > 0 ?
+			                     bounds.max_velocity_ : DEFAULT_JOINT_VELOCITY);
+	return velocities;
+}
+
+/** Lower bound of the time of a synchronized joint move */
+double estimateMoveSeconds(const JointPositions& from, const JointPositions& to, const vector<double>& max_velocities){
+	double seconds = 0;
+	for (size_t joint_idx = 0; joint_idx < from.size(); ++joint_idx)
+		seconds = max(seconds, fabs(to[joint_idx] - from[joint_idx]) / max_velocities[joint_idx]);
+	return seconds;
+}
+
+/** Yoshikawa measure sqrt(det(J J^T)) of the group at the state */
+double getManipulability(const robot_state::RobotState& kinematic_state, const robot_state::JointModelGroup* jmg_ptr){
+	Eigen::MatrixXd jacobian = kinematic_state.getJacobian(jmg_ptr);
+	return sqrt(max(0.0, (jacobian * jacobian.transpose()).determinant()));
+}
+
+/** IK of the sample pose, from the seed if there is one, from the start state if that misses */
+bool solveSample(robot_state::RobotState& kinematic_state, const robot_state::JointModelGroup* jmg_ptr,
+                 const Eigen::Affine3d& pose, const JointPositions& seed, const JointPositions& start_positions,
+                 const PlannerConfig& config){
+	if (!seed.empty()){
+		kinematic_state.setJointGroupPositions(jmg_ptr, seed);
+		if (kinematic_state.setFromIK(jmg_ptr, pose, config.end_effector, 1, config.ik_timeout))
+			return true;
+	}
+	kinematic_state.setJointGroupPositions(jmg_ptr, start_positions);
+	return kinematic_state.setFromIK(jmg_ptr, pose, config.end_effector, 1, config.ik_timeout);
+}
+
+/** Batch IK along the seam placed in the model frame, the screen keeps the previous entry as seed on a miss */
+void screenSeam(PlanningContext& context, const Eigen::Affine3d& placement_transform, const Seam& seam,
+                const JointPositions& start_positions, const vector<const robot_state::LinkModel*>& links,
+                const vector<double>& max_velocities, SeamScreen& screen){
+	const PlannerConfig& config = context.planner->getConfig();
+	robot_state::RobotState kinematic_state(context.loader->getModel());
+	kinematic_state.setToDefaultValues();
+	const robot_state::JointModelGroup* jmg_ptr = kinematic_state.getJointModelGroup(config.planning_group);
+
+	Eigen::Affine3d start_pose = placement_transform * seam.ends[0];
+	Eigen::Affine3d end_pose = placement_transform * seam.ends[1];
+	Eigen::Quaterniond start_quaternion(start_pose.rotation());
+	Eigen::Quaterniond end_quaternion(end_pose.rotation());
+	size_t steps = max<size_t>(1, ceil((end_pose.translation() - start_pose.translation()).norm() / SCREEN_STEP));
+
+	screen.reached = false;
+	Trail samples;
+	JointPositions seed = screen.entry;
+	double min_manipulability = numeric_limits<double>::infinity();
+	for (size_t step = 0; step <= steps; ++step){
+		double percentage = (double)step / steps;
+		Eigen::Affine3d pose(start_quaternion.slerp(percentage, end_quaternion));
+		pose.translation() = percentage * end_pose.translation() + (1 - percentage) * start_pose.translation();
+		if (!solveSample(kinematic_state, jmg_ptr, pose, seed, start_positions, config))
+			return;
+		kinematic_state.update();
+		if (context.scene->isStateColliding(kinematic_state, config.planning_group))
+			return;
+		kinematic_state.copyJointGroupPositions(jmg_ptr, seed);
+		min_manipulability = min(min_manipulability, getManipulability(kinematic_state, jmg_ptr));
+		samples.push_back(robot_state::RobotStatePtr(new robot_state::RobotState(kinematic_state)));
+	}
+	for (const robot_state::LinkModel* link : links)
+		if (getPeakLinkTranslation(samples, link) > JUMP_DISTANCE)
+			return;
+
+	screen.reached = true;
+	screen.min_manipulability = min_manipulability;
+	samples.front()->copyJointGroupPositions(jmg_ptr, screen.entry);
+	samples.back()->copyJointGroupPositions(jmg_ptr, screen.exit);
+	screen.seconds = 0;
+	JointPositions previous_positions = screen.entry, positions;
+	for (const robot_state::RobotStatePtr& sample : samples){
+		sample->copyJointGroupPositions(jmg_ptr, positions);
+		screen.seconds += estimateMoveSeconds(previous_positions, positions, max_velocities);
+		previous_positions = positions;
+	}
+}
+
+/** Screen every seam, the screens of the previous placement of the worker seed this one */
+PlacementResult evaluatePlacement(PlanningContext& context, const Placement& placement, const vector<Seam>& seams,
+                                  const JointPositions& start_positions,
+                                  const vector<const robot_state::LinkModel*>& links,
+                                  const vector<double>& max_velocities, vector<SeamScreen>& screens){
+	PlacementResult result = {placement, 0, numeric_limits<double>::infinity(), 0.0, 0.0, -1};
+	Eigen::Affine3d placement_transform = placement.transform();
+	const JointPositions* previous_exit = &start_positions;
+	for (size_t seam_idx = 0; seam_idx < seams.size(); ++seam_idx){
+		SeamScreen& screen = screens[seam_idx];
+		screenSeam(context, placement_transform, seams[seam_idx], start_positions, links, max_velocities, screen);
+		if (!screen.reached)
+			continue;
+		result.reached_seams++;
+		result.min_manipulability = min(result.min_manipulability, screen.min_manipulability);
+		result.cycle_seconds += estimateMoveSeconds(*previous_exit, screen.entry, max_velocities) + screen.seconds;
+		previous_exit = &screen.exit;
+	}
+	if (!result.reached_seams)
+		result.min_manipulability = 0;
+	else
+		result.cycle_seconds += estimateMoveSeconds(*previous_exit, start_positions, max_velocities);
+	return result;
+}
+
+/** Plan every reached seam of the placement through the pipeline from its screened entry */
+int confirmPlacement(PlanningContext& context, const PlacementResult& result, const vector<Seam>& seams,
+                     const JointPositions& start_positions, const vector<const robot_state::LinkModel*>& links,
+                     const vector<double>& max_velocities){
+	const PlannerConfig& config = context.planner->getConfig();
+	robot_state::RobotState kinematic_state(context.loader->getModel());
+	kinematic_state.setToDefaultValues();
+	const robot_state::JointModelGroup* jmg_ptr = kinematic_state.getJointModelGroup(config.planning_group);
+	Eigen::Affine3d placement_transform = result.placement.transform();
+
+	int planned_seams = 0;
+	for (const Seam& seam : seams){
+		SeamScreen screen = SeamScreen();
+		screenSeam(context, placement_transform, seam, start_positions, links, max_velocities, screen);
+		if (!screen.reached)
+			continue;
+		kinematic_state.setJointGroupPositions(jmg_ptr, screen.entry);
+		kinematic_state.update();
+		Trail trail;
+		RequestSeeds seeds(seam.id);
+		SeedRequestScope seed_scope(&seeds);
+		planned_seams += context.planner->plan(trail, kinematic_state, placement_transform * seam.ends[1]);
+	}
+	return planned_seams;
+}
+
+vector<double> gridValues(double first, double last, double step){
+	vector<double> values;
+	for (double value = first; value <= last + 1e-9; value += step)
+		values.push_back(value);
+	return values;
+}
+
+int main(int argc, char** argv)
+{
+	ros::init(argc, argv, "placement_optimizer");
+	if (argc < 3){
+		fprintf(stderr, "Usage: placement_optimizer <seams> <placements.csv> [--workers N] [--grid x0,x1,y0,y1,z0,z1] "
+		        "[--step m] [--yaw-step rad] [--confirm K] [--weights manipulability,cycle] [--scene file]\n");
+		return 1;
+	}
+	size_t worker_count = max(1u, thread::hardware_concurrency());
+	vector<double> grid = {0.6, 1.4, -0.6, 0.6, 0.0, 0.6};
+	double grid_step = DEFAULT_GRID_STEP;
+	double yaw_step = DEFAULT_YAW_STEP;
+	size_t confirmed_placements = DEFAULT_CONFIRMED_PLACEMENTS;
+	double manipulability_weight = DEFAULT_MANIPULABILITY_WEIGHT;
+	double cycle_weight = DEFAULT_CYCLE_WEIGHT;
+	string scene_path;
+	for (int arg_idx = 3; arg_idx + 1 < argc; arg_idx += 2){
+		string option = argv[arg_idx];
+		if (option == "--workers")
+			worker_count = max(1, atoi(argv[arg_idx + 1]));
+		else if (option == "--grid")
+			grid = parseList(argv[arg_idx + 1]);
+		else if (option == "--step")
+			grid_step = atof(argv[arg_idx + 1]);
+		else if (option == "--yaw-step")
+			yaw_step = atof(argv[arg_idx + 1]);
+		else if (option == "--confirm")
+			confirmed_placements = max(0, atoi(argv[arg_idx + 1]));
+		else if (option == "--weights"){
+			vector<double> weights = parseList(argv[arg_idx + 1]);
+			if (weights.size() == 2){
+				manipulability_weight = weights[0];
+				cycle_weight = weights[1];
+			}
+		}
+		else if (option == "--scene")
+			scene_path = argv[arg_idx + 1];
+	}
+	if (grid.size() != 6 || grid_step <= 0 || yaw_step <= 0){
+		fprintf(stderr, "The grid needs x0,x1,y0,y1,z0,z1 and positive steps\n");
+		return 1;
+	}
+
+	vector<Seam> seams = loadSeams(argv[1]);
+	if (seams.empty()){
+		fprintf(stderr, "No seams in %s\n", argv[1]);
+		return 1;
+	}
+	//Rows along x, so the consecutive placements of a worker are neighbours and their IK solutions good seeds
+	vector<double> xs = gridValues(grid[0], grid[1], grid_step);
+	vector<vector<Placement>> rows;
+	for (double yaw = -M_PI; yaw < M_PI - 1e-9; yaw += yaw_step)
+		for (double z : gridValues(grid[4], grid[5], grid_step))
+			for (double y : gridValues(grid[2], grid[3], grid_step)){
+				rows.push_back(vector<Placement>());
+				for (double x : xs)
+					rows.back().push_back(Placement{x, y, z, yaw});
+			}
+	if (xs.empty() || rows.empty()){
+		fprintf(stderr, "The grid has no placements\n");
+		return 1;
+	}
+
+	ros::NodeHandle node_handle;
+	PlannerConfig config;
+	loadPlannerConfig(ros::NodeHandle("~"), config);
+
+	if (scene_path.empty())
+		ROS_WARN("No --scene given, placements are only checked for self collisions");
+
+	//Loaders are created one by one, pluginlib isn't safe to use concurrently
+	vector<PlanningContext> contexts(min(worker_count, rows.size()));
+	for (PlanningContext& context : contexts){
+		context.loader.reset(new robot_model_loader::RobotModelLoader(DEFAULT_ROBOT_DESCRIPTION));
+		context.scene.reset(new planning_scene::PlanningScene(context.loader->getModel()));
+		if (!scene_path.empty())
+			loadSceneGeometry(*context.scene, scene_path);
+		context.planner.reset(new CartesianPathPlanner(context.loader->getModel(), context.scene, config));
+	}
+	robot_model::RobotModelConstPtr kt_kinematic_model = contexts.front().loader->getModel();
+	const robot_state::JointModelGroup* jmg_ptr = kt_kinematic_model->getJointModelGroup(config.planning_group);
+	vector<double> max_velocities = getMaxVelocities(jmg_ptr);
+	robot_state::RobotState start_state(kt_kinematic_model);
+	setToStartState(start_state, config);
+	JointPositions start_positions;
+	start_state.copyJointGroupPositions(jmg_ptr, start_positions);
+
+	vector<vector<PlacementResult>> row_results(rows.size());
+	atomic<size_t> next_row(0);
+	vector<thread> workers;
+	chrono::steady_clock::time_point screen_start = chrono::steady_clock::now();
+	for (PlanningContext& context : contexts)
+		workers.push_back(thread([&](){
+			//Links are looked up in the model of the worker, the bound is computed from its states
+			vector<const robot_state::LinkModel*> links = getRefinedLinks(context.loader->getModel());
+			for (size_t row_idx = next_row++; row_idx < rows.size(); row_idx = next_row++){
+				vector<SeamScreen> screens(seams.size(), SeamScreen());
+				for (const Placement& placement : rows[row_idx])
+					row_results[row_idx].push_back(evaluatePlacement(context, placement, seams, start_positions, links,
+					                                                 max_velocities, screens));
+			}
+		}));
+	for (thread& worker : workers)
+		worker.join();
+	double screen_seconds = chrono::duration<double>(chrono::steady_clock::now() - screen_start).count();
+
+	vector<PlacementResult> results;
+	for (const vector<PlacementResult>& row : row_results)
+		results.insert(results.end(), row.begin(), row.end());
+	double best_manipulability = 0, best_seam_seconds = numeric_limits<double>::infinity();
+	for (const PlacementResult& result : results)
+		if (result.reached_seams){
+			best_manipulability = max(best_manipulability, result.min_manipulability);
+			best_seam_seconds = min(best_seam_seconds, result.cycle_seconds / result.reached_seams);
+		}
+	for (PlacementResult& result : results){
+		if (!result.reached_seams)
+			continue;
+		result.score = (double)result.reached_seams / seams.size();
+		if (best_manipulability > 0)
+			result.score += manipulability_weight * result.min_manipulability / best_manipulability;
+		if (best_seam_seconds > 0)
+			result.score -= cycle_weight * (result.cycle_seconds / result.reached_seams / best_seam_seconds - 1);
+	}
+	//The cycle term can go negative, a placement reaching more seams still ranks first
+	sort(results.begin(), results.end(), [](const PlacementResult& first, const PlacementResult& second){
+		if (first.reached_seams != second.reached_seams)
+			return first.reached_seams > second.reached_seams;
+		return first.score > second.score;
+	});
+
+	//The best placements go through the whole pipeline, one per worker
+	size_t reaching_count = 0;
+	while (reaching_count < results.size() && results[reaching_count].reached_seams)
+		reaching_count++;
+	size_t confirmed_count = min(confirmed_placements, reaching_count);
+	atomic<size_t> next_result(0);
+	workers.clear();
+	for (size_t worker_idx = 0; worker_idx < min(contexts.size(), confirmed_count); ++worker_idx)
+		workers.push_back(thread([&, worker_idx](){
+			PlanningContext& context = contexts[worker_idx];
+			vector<const robot_state::LinkModel*> links = getRefinedLinks(context.loader->getModel());
+			for (size_t result_idx = next_result++; result_idx < confirmed_count; result_idx = next_result++)
+				results[result_idx].planned_seams = confirmPlacement(context, results[result_idx], seams,
+				                                                     start_positions, links, max_velocities);
+		}));
+	for (thread& worker : workers)
+		worker.join();
+
+	ofstream output(argv[2]);
+	output << "x,y,z,yaw,reached_seams,min_manipulability,cycle_seconds,score,planned_seams\n";
+	for (const PlacementResult& result : results)
+		output << result.placement.x << "," << result.placement.y << "," << result.placement.z << ","
+		       << result.placement.yaw << "," << result.reached_seams << "," << result.min_manipulability << ","
+		       << result.cycle_seconds << "," << result.score << "," << result.planned_seams << "\n";
+
+	printf("Placements: %lu screened in %.1f s by %lu workers (%.0f per second)\n", results.size(), screen_seconds,
+	       contexts.size(), results.size() / screen_seconds);
+	for (size_t result_idx = 0; result_idx < confirmed_count; ++result_idx){
+		const PlacementResult& result = results[result_idx];
+		printf("x %.2f y %.2f z %.2f yaw %.2f: seams %lu of %lu, planned %d, manipulability %.4f, cycle %.2f s, "
+		       "score %.3f\n", result.placement.x, result.placement.y, result.placement.z, result.placement.yaw,
+		       result.reached_seams, seams.size(), result.planned_seams, result.min_manipulability,
+		       result.cycle_seconds, result.score);
+	}
+	return results.front().reached_seams ? 0 : 1;
+}
@@ -0,0 +1,344 @@
+/*********************************************************************
+ * Planner as a nodelet. Goals are poses in the model frame, others are
+ * rejected. Trajectories are published as shared pointers, so consumers
+ * loaded into the same manager receive them without copies. Optionally
+ * every validated trajectory is also put into a shared-memory ring for
+ * a controller running in another process. Both carry the timing,
+ * velocities and accelerations the planner validated. With the analytics
+ * stage on, the metrics of every planned trajectory, rejected ones
+ * included, are published as diagnostics on trajectory_metrics. The
+ * startup time is logged phase by phase.
+ *
+ * The reload_model service loads the robot description, the kinematics
+ * config, the planner parameters and the scene again while goals are
+ * still planned on the current model, then swaps the new model in
+ * between two goals. A goal keeps the model it started on. With a
+ * shared-memory ring a reload may not change the joint count of the
+ * planning group.
+ *
+ * With a monitor horizon every published trajectory is watched during
+ * its execution against the live scene, stop and replan signals are
+ * published as diagnostics on execution_monitor.
+ *********************************************************************/
+
+#include <ros/ros.h>
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+#include <memory>
+#include <mutex>
+#include <diagnostic_msgs/DiagnosticStatus.h>
+#include <geometry_msgs/PoseStamped.h>
+#include <std_srvs/Trigger.h>
+#include <trajectory_msgs/JointTrajectory.h>
+#include <tf2_eigen/tf2_eigen.h>
+#include <moveit/robot_model_loader/robot_model_loader.h>
+#include <moveit/planning_scene_monitor/planning_scene_monitor.h>
+#include <kinematics_test/cartesian_path_planner.h>
+#include <kinematics_test/execution_monitor.h>
+#include <kinematics_test/startup_loading.h>
+#include <kinematics_test/trajectory_shm_transport.h>
+
+#define DEFAULT_ROBOT_DESCRIPTION "robot_description"
+#define DEFAULT_MONITOR_STOP_WAYPOINTS 5
+#define DEFAULT_MONITOR_LATENCY_MS 50.0
+//Hz, the joint states move the horizon at most this often
+#define DEFAULT_MONITOR_RATE 30.0
+
+using namespace std;
+using namespace moveit;
+using namespace core;
+
+namespace kinematics_test {
+
+/** Model, scene and planner of one load, a goal holds the session it started on */
+struct PlanningSession {
+	PlanningModel planning_model;
+	robot_model::RobotModelConstPtr kinematic_model;
+	unique_ptr<CartesianPathPlanner> planner;
+	size_t generation;
+	//Only with a monitor horizon, the monitor is destroyed before the scene it follows
+	planning_scene_monitor::PlanningSceneMonitorPtr live_scene_monitor;
+	unique_ptr<ExecutionMonitor> monitor;
+};
+
+class PlannerNodelet : public nodelet::Nodelet {
+private:
+	void onInit() override{
+		ros::NodeHandle& node_handle = getNodeHandle();
+		ros::NodeHandle& private_handle = getPrivateNodeHandle();
+
+		int monitor_horizon, monitor_stop_waypoints;
+		private_handle.param("monitor_horizon", monitor_horizon, 0);
+		private_handle.param("monitor_stop_waypoints", monitor_stop_waypoints, DEFAULT_MONITOR_STOP_WAYPOINTS);
+		private_handle.param("monitor_latency_ms", monitor_config_.latency_budget_ms, DEFAULT_MONITOR_LATENCY_MS);
+		private_handle.param("monitor_rate", monitor_rate_, DEFAULT_MONITOR_RATE);
+		if (monitor_horizon < 0 || monitor_stop_waypoints < 0 || monitor_config_.latency_budget_ms <= 0 ||
+				monitor_rate_ <= 0)
+			throw runtime_error("Invalid execution monitor parameters in " + private_handle.getNamespace());
+		monitor_config_.horizon = monitor_horizon;
+		monitor_config_.stop_waypoints = monitor_stop_waypoints;
+		monitor_publisher_ = node_handle.advertise<diagnostic_msgs::DiagnosticStatus>("execution_monitor", 1);
+
+		session_ = loadSession(nullptr);
+		start_state_.reset(new robot_state::RobotState(session_->kinematic_model));
+		start_state_->setToDefaultValues();
+
+		//Goals arrive as bare poses, so the path policy is set per nodelet
+		string path_policy;
+		private_handle.param<string>("path_policy", path_policy, "cartesian");
+		if (!parsePathPolicy(path_policy, path_policy_))
+			throw runtime_error("Unknown path policy " + path_policy);
+
+		string shm_name;
+		private_handle.param<string>("shm_name", shm_name, "");
+		if (!shm_name.empty()){
+			const robot_state::JointModelGroup* jmg_ptr =
+					session_->kinematic_model->getJointModelGroup(session_->planner->getConfig().planning_group);
+			shm_ring_.reset(new TrajectoryShmRing(shm_name, SHM_TRAJECTORY_SLOTS, SHM_TRAJECTORY_MAX_WAYPOINTS,
+			                                      jmg_ptr->getVariableCount()));
+			NODELET_INFO("Trajectories are also written to shared memory %s", shm_name.c_str());
+		}
+
+		trajectory_publisher_ = node_handle.advertise<trajectory_msgs::JointTrajectory>("trajectory", 1);
+		metrics_publisher_ = node_handle.advertise<diagnostic_msgs::DiagnosticStatus>("trajectory_metrics", 1);
+		goal_subscriber_ = node_handle.subscribe("goal", 1, &PlannerNodelet::goalCallback, this);
+		//Served by the multi-threaded queue, goals keep being planned while a model loads
+		reload_service_ = getMTPrivateNodeHandle().advertiseService("reload_model", &PlannerNodelet::reloadCallback,
+		                                                            this);
+		private_handle.setParam("ready", true);
+	}
+
+	/** Load everything from the parameter server, the collision geometry is built again */
+	shared_ptr<const PlanningSession> loadSession(const shared_ptr<const PlanningSession>& previous){
+		PlannerConfig config;
+		loadPlannerConfig(getPrivateNodeHandle(), config);
+		StartupReport startup;
+		shared_ptr<PlanningSession> session(new PlanningSession());
+		session->planning_model = loadPlanningModel(DEFAULT_ROBOT_DESCRIPTION, config.planning_group, &startup);
+		session->kinematic_model = session->planning_model.loader->getModel();
+		session->planner.reset(new CartesianPathPlanner(session->kinematic_model,
+		                                                session->planning_model.scene_monitor->getPlanningScene(),
+		                                                config));
+		session->generation = previous ? previous->generation + 1 : 0;
+
+		if (monitor_config_.horizon){
+			StartupPhaseScope phase(&startup, "live_scene");
+			//A scene of its own, the planner keeps validating against the scene it was loaded with
+			session->live_scene_monitor.reset(new planning_scene_monitor::PlanningSceneMonitor(
+					session->planning_model.loader));
+			session->live_scene_monitor->setStateUpdateFrequency(monitor_rate_);
+			session->live_scene_monitor->startSceneMonitor();
+			session->live_scene_monitor->startWorldGeometryMonitor();
+			session->live_scene_monitor->startStateMonitor();
+			MonitorConfig monitor_config = monitor_config_;
+			monitor_config.planning_group = config.planning_group;
+			session->monitor.reset(new ExecutionMonitor(session->live_scene_monitor,
+			                                            getRefinedLinks(session->kinematic_model), monitor_config,
+			                                            [this](const MonitorEvent& event){
+				publishMonitorEvent(event);
+			}));
+		}
+
+		robot_state::RobotState warm_up_state(session->kinematic_model);
+		warm_up_state.setToDefaultValues();
+		{
+			StartupPhaseScope phase(&startup, "warm_up");
+			session->planner->warmUp(warm_up_state);
+		}
+		startup.log();
+		return session;
+	}
+
+	shared_ptr<const PlanningSession> currentSession(){
+		lock_guard<mutex> lock(session_mutex_);
+		return session_;
+	}
+
+	bool reloadCallback(std_srvs::Trigger::Request& request, std_srvs::Trigger::Response& response){
+		lock_guard<mutex> reload_lock(reload_mutex_);
+		shared_ptr<const PlanningSession> session;
+		try {
+			session = loadSession(currentSession());
+		}
+		catch (const exception& error){
+			NODELET_ERROR("Reload failed, the current model stays: %s", error.what());
+			response.success = false;
+			response.message = error.what();
+			return true;
+		}
+		//A controller attached to the ring reads slots of the joint count it was created with
+		size_t joint_count = session->kinematic_model->getJointModelGroup(
+				session->planner->getConfig().planning_group)->getVariableCount();
+		if (shm_ring_ && joint_count != shm_ring_->getJointCount()){
+			response.success = false;
+			response.message = "The planning group has " + to_string(joint_count) + " variables, the shared memory "
+					"ring " + to_string(shm_ring_->getJointCount()) + ", the current model stays";
+			NODELET_ERROR("Reload rejected: %s", response.message.c_str());
+			return true;
+		}
+		{
+			//Waits for the goal being planned. The start state moves to the new model with the swap, a state of the
+			//old model would keep its solvers alive after the plugin loader of the old session is gone
+			lock_guard<mutex> plan_lock(plan_mutex_);
+			start_state_ = transferState(*start_state_, session->kinematic_model);
+			lock_guard<mutex> lock(session_mutex_);
+			session_ = session;
+		}
+		NODELET_INFO("Model generation %lu is active", session->generation);
+		response.success = true;
+		response.message = "Model generation " + to_string(session->generation) + " is active";
+		return true;
+	}
+
+	/** Same joint positions in a state of another model, joints it doesn't have are left out */
+	static robot_state::RobotStatePtr transferState(const robot_state::RobotState& state,
+	                                                const robot_model::RobotModelConstPtr& kinematic_model){
+		robot_state::RobotStatePtr transferred_state(new robot_state::RobotState(kinematic_model));
+		transferred_state->setToDefaultValues();
+		for (const robot_state::JointModel* joint : state.getRobotModel()->getActiveJointModels())
+			if (kinematic_model->hasJointModel(joint->getName()))
+				transferred_state->setJointPositions(joint->getName(), state.getJointPositions(joint));
+		transferred_state->update();
+		return transferred_state;
+	}
+
+	/** Frames compared without a leading slash, tf2 drops it */
+	static bool isSameFrame(const string& frame, const string& other_frame){
+		auto strip = [](const string& name){ return name.empty() || name[0] != '/' ? name : name.substr(1); };
+		return strip(frame) == strip(other_frame);
+	}
+
+	/** Plan from the end of the previous move to the goal given in the model frame, goals in other frames are
+	 * rejected */
+	void goalCallback(const geometry_msgs::PoseStamped::ConstPtr& goal){
+		lock_guard<mutex> lock(plan_mutex_);
+		shared_ptr<const PlanningSession> session = currentSession();
+		if (!isSameFrame(goal->header.frame_id, session->kinematic_model->getModelFrame())){
+			NODELET_ERROR("Goal in frame '%s' rejected, goals are expected in the model frame %s",
+			              goal->header.frame_id.c_str(), session->kinematic_model->getModelFrame().c_str());
+			return;
+		}
+		Eigen::Affine3d goal_transform;
+		tf2::fromMsg(goal->pose, goal_transform);
+		const robot_state::JointModelGroup* jmg_ptr =
+				session->kinematic_model->getJointModelGroup(session->planner->getConfig().planning_group);
+		Trail trail;
+		RequestMemory memory;
+		TrajectoryMetrics metrics = TrajectoryMetrics();
+		robot_trajectory::RobotTrajectory timed_trajectory(session->kinematic_model, jmg_ptr->getName());
+		bool is_planned = session->planner->plan(trail, *start_state_, goal_transform, true, path_policy_, &memory,
+		                                         &metrics, &timed_trajectory);
+		//The manager's allocator isn't hooked, only the resident set is known
+		NODELET_DEBUG("Process peak RSS %.1f MB after the request", memory.peak_rss_bytes / 1048576.0);
+		if (metrics.waypoint_count)
+			publishMetrics(*session, metrics);
+		if (!is_planned){
+			NODELET_ERROR("Invalid trajectory!");
+			return;
+		}
+		start_state_.reset(new robot_state::RobotState(*trail.back()));
+
+		//The controller gets the timing the planner validated, not one of its own
+		if (shm_ring_ && !shm_ring_->write(timed_trajectory, jmg_ptr))
+			NODELET_WARN("Trajectory of %lu waypoints doesn't fit into shared memory", trail.size());
+
+		//Ownership passes to the middleware, intra-process subscribers get this very object
+		trajectory_msgs::JointTrajectoryPtr trajectory(new trajectory_msgs::JointTrajectory());
+		trajectory->header.frame_id = session->kinematic_model->getModelFrame();
+		trajectory->header.stamp = ros::Time::now();
+		trajectory->joint_names = jmg_ptr->getVariableNames();
+		trajectory->points.resize(timed_trajectory.getWayPointCount());
+		for (size_t point_idx = 0; point_idx < trajectory->points.size(); ++point_idx){
+			const robot_state::RobotState& state = timed_trajectory.getWayPoint(point_idx);
+			trajectory_msgs::JointTrajectoryPoint& point = trajectory->points[point_idx];
+			state.copyJointGroupPositions(jmg_ptr, point.positions);
+			state.copyJointGroupVelocities(jmg_ptr, point.velocities);
+			state.copyJointGroupAccelerations(jmg_ptr, point.accelerations);
+			point.time_from_start = ros::Duration(timed_trajectory.getWayPointDurationFromStart(point_idx));
+		}
+		trajectory_publisher_.publish(trajectory);
+
+		if (monitored_session_ && monitored_session_ != session)
+			monitored_session_->monitor->clear();
+		monitored_session_ = session->monitor ? session : nullptr;
+		if (session->monitor)
+			session->monitor->setTrail(trail);
+	}
+
+	void publishMonitorEvent(const MonitorEvent& event){
+		NODELET_WARN("Execution monitor: %s at waypoint %lu, %s", monitorSignalName(event.signal),
+		             event.current_waypoint, event.reason.c_str());
+		diagnostic_msgs::DiagnosticStatusPtr status(new diagnostic_msgs::DiagnosticStatus());
+		status->name = "execution_monitor";
+		status->level = event.signal == MONITOR_STOP ? diagnostic_msgs::DiagnosticStatus::ERROR :
+		                diagnostic_msgs::DiagnosticStatus::WARN;
+		status->message = monitorSignalName(event.signal);
+
+		auto addValue = [&status](const string& key, double value){
+			diagnostic_msgs::KeyValue key_value;
+			key_value.key = key;
+			key_value.value = to_string(value);
+			status->values.push_back(key_value);
+		};
+		addValue("current_waypoint", event.current_waypoint);
+		addValue("colliding_waypoint", event.colliding_waypoint);
+		addValue("latency_ms", event.latency_ms);
+		addValue("collision_queries", event.collision_queries);
+		monitor_publisher_.publish(status);
+	}
+
+	void publishMetrics(const PlanningSession& session, const TrajectoryMetrics& metrics){
+		diagnostic_msgs::DiagnosticStatusPtr status(new diagnostic_msgs::DiagnosticStatus());
+		status->name = "trajectory_metrics";
+		status->hardware_id = session.kinematic_model->getName();
+		status->level = metrics.violation.empty() ? diagnostic_msgs::DiagnosticStatus::OK :
+		                diagnostic_msgs::DiagnosticStatus::ERROR;
+		status->message = metrics.violation.empty() ? "within limits" : metrics.violation;
+
+		auto addValue = [&status](const string& key, double value){
+			diagnostic_msgs::KeyValue key_value;
+			key_value.key = key;
+			key_value.value = to_string(value);
+			status->values.push_back(key_value);
+		};
+		addValue("waypoints", metrics.waypoint_count);
+		addValue("duration", metrics.duration);
+		addValue("cartesian_deviation", metrics.cartesian_deviation);
+		addValue("model_generation", session.generation);
+		const vector<string>& joint_names = session.kinematic_model->getJointModelGroup(
+				session.planner->getConfig().planning_group)->getVariableNames();
+		for (size_t joint_idx = 0; joint_idx < joint_names.size(); ++joint_idx){
+			addValue(joint_names[joint_idx] + "/peak_velocity", metrics.peak_velocity[joint_idx]);
+			addValue(joint_names[joint_idx] + "/peak_acceleration", metrics.peak_acceleration[joint_idx]);
+			addValue(joint_names[joint_idx] + "/peak_jerk", metrics.peak_jerk[joint_idx]);
+		}
+		vector<const robot_state::LinkModel*> links = getRefinedLinks(session.kinematic_model);
+		for (size_t link_idx = 0; link_idx < links.size(); ++link_idx)
+			addValue(links[link_idx]->getName() + "/swept_distance", metrics.link_swept_distance[link_idx]);
+		metrics_publisher_.publish(status);
+	}
+
+	//Replaced as a whole by a reload, never modified in place
+	shared_ptr<const PlanningSession> session_;
+	mutex session_mutex_;
+	//One reload at a time
+	mutex reload_mutex_;
+	PathPolicy path_policy_;
+	unique_ptr<TrajectoryShmRing> shm_ring_;
+	robot_state::RobotStatePtr start_state_;
+	MonitorConfig monitor_config_;
+	double monitor_rate_;
+	//Session whose monitor watches the last published trajectory
+	shared_ptr<const PlanningSession> monitored_session_;
+	mutex plan_mutex_;
+	ros::Publisher trajectory_publisher_;
+	ros::Publisher metrics_publisher_;
+	ros::Publisher monitor_publisher_;
+	ros::Subscriber goal_subscriber_;
+	ros::ServiceServer reload_service_;
+};
+
+}
+
+PLUGINLIB_EXPORT_CLASS(kinematics_test::PlannerNodelet, nodelet::Nodelet)
@@ -0,0 +1,143 @@
+#include <kinematics_test/refinement_report.h>
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <ros/ros.h>
+
+using namespace std;
+
+namespace kinematics_test {
+
+namespace {
+
+thread_local RefinementReport* current_report = nullptr;
+
+//Width of the heat lines in metres
+const double MARKER_LINE_WIDTH = 0.004;
+
+/** Blue without bisections, red for the most bisected segment */
+std_msgs::ColorRGBA heatColor(size_t bisections, size_t max_bisections){
+	double heat = max_bisections ? (double)bisections / max_bisections : 0.0;
+	std_msgs::ColorRGBA color;
+	color.r = heat;
+	color.g = 0.2;
+	color.b = 1.0 - heat;
+	color.a = 1.0;
+	return color;
+}
+
+geometry_msgs::Point toPoint(const Eigen::Vector3d& position){
+	geometry_msgs::Point point;
+	point.x = position.x();
+	point.y = position.y();
+	point.z = position.z();
+	return point;
+}
+
+}
+
+void RefinementReport::add(const RefinementRecord& record){
+	records_.push_back(record);
+}
+
+void RefinementReport::clear(){
+	records_.clear();
+}
+
+size_t RefinementReport::getBisectionCount() const{
+	size_t bisections = 0;
+	for (const RefinementRecord& record : records_)
+		bisections += record.bisections;
+	return bisections;
+}
+
+void RefinementReport::writeCsv(ostream& output) const{
+	output.precision(numeric_limits<double>::digits10);
+	output << "link,segment,initial_distance,allowed_distance,bisections,final_distance,attempt,"
+	       "start_x,start_y,start_z,end_x,end_y,end_z\n";
+	for (const RefinementRecord& record : records_)
+		output << record.link << "," << record.segment << "," << record.initial_distance << ","
+		       << record.allowed_distance << "," << record.bisections << "," << record.final_distance << ","
+		       << record.attempt << "," << record.start_position.x() << "," << record.start_position.y() << ","
+		       << record.start_position.z() << "," << record.end_position.x() << "," << record.end_position.y()
+		       << "," << record.end_position.z() << "\n";
+}
+
+void RefinementReport::writeJson(ostream& output) const{
+	output.precision(numeric_limits<double>::digits10);
+	output << "{\"bisections\": " << getBisectionCount() << ", \"records\": [";
+	for (size_t record_idx = 0; record_idx < records_.size(); ++record_idx){
+		const RefinementRecord& record = records_[record_idx];
+		//Link names are URDF identifiers, nothing to escape
+		output << (record_idx ? ",\n" : "\n") << "  {\"link\": \"" << record.link << "\", \"segment\": "
+		       << record.segment << ", \"initial_distance\": " << record.initial_distance
+		       << ", \"allowed_distance\": " << record.allowed_distance << ", \"bisections\": " << record.bisections
+		       << ", \"final_distance\": " << record.final_distance << ", \"attempt\": " << record.attempt
+		       << ", \"start\": [" << record.start_position.x() << ", " << record.start_position.y() << ", "
+		       << record.start_position.z() << "], \"end\": [" << record.end_position.x() << ", "
+		       << record.end_position.y() << ", " << record.end_position.z() << "]}";
+	}
+	output << "\n]}\n";
+}
+
+void RefinementReport::save(const string& path) const{
+	ofstream output(path.c_str());
+	if (!output)
+		throw runtime_error("Can't write the refinement report to " + path);
+	const string json_extension = ".json";
+	if (path.size() >= json_extension.size() &&
+			path.compare(path.size() - json_extension.size(), json_extension.size(), json_extension) == 0)
+		writeJson(output);
+	else
+		writeCsv(output);
+}
+
+visualization_msgs::MarkerArray RefinementReport::toMarkers(const string& frame_id) const{
+	size_t max_bisections = 0;
+	for (const RefinementRecord& record : records_)
+		max_bisections = max(max_bisections, record.bisections);
+
+	visualization_msgs::MarkerArray markers;
+	map<string, size_t> link_markers;
+	for (const RefinementRecord& record : records_){
+		map<string, size_t>::const_iterator known = link_markers.find(record.link);
+		if (known == link_markers.end()){
+			visualization_msgs::Marker marker;
+			marker.header.frame_id = frame_id;
+			marker.header.stamp = ros::Time::now();
+			marker.ns = record.link;
+			marker.id = 0;
+			marker.type = visualization_msgs::Marker::LINE_LIST;
+			marker.action = visualization_msgs::Marker::ADD;
+			marker.pose.orientation.w = 1.0;
+			marker.scale.x = MARKER_LINE_WIDTH;
+			marker.color.a = 1.0;
+			known = link_markers.insert(make_pair(record.link, markers.markers.size())).first;
+			markers.markers.push_back(marker);
+		}
+		visualization_msgs::Marker& marker = markers.markers[known->second];
+		std_msgs::ColorRGBA color = heatColor(record.bisections, max_bisections);
+		marker.points.push_back(toPoint(record.start_position));
+		marker.points.push_back(toPoint(record.end_position));
+		marker.colors.push_back(color);
+		marker.colors.push_back(color);
+	}
+	return markers;
+}
+
+RefinementReportScope::RefinementReportScope(RefinementReport* report) : previous_(current_report){
+	current_report = report;
+}
+
+RefinementReportScope::~RefinementReportScope(){
+	current_report = previous_;
+}
+
+RefinementReport* RefinementReportScope::current(){
+	return current_report;
+}
+
+}
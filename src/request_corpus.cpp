@@ -0,0 +1,76 @@
+#include <kinematics_test/request_corpus.h>
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace kinematics_test {
+
+vector<PlanningRequest> loadRequestCorpus(const string& path){
+	ifstream corpus(path.c_str());
+	if (!corpus)
+		throw runtime_error("Can't open request corpus " + path);
+
+	vector<PlanningRequest> requests;
+	string line;
+	size_t line_number = 0;
+	while (getline(corpus, line)){
+		line_number++;
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		istringstream fields(line);
+		PlanningRequest request;
+		string frame;
+		double x, y, z, roll, pitch, yaw;
+		if (!(fields >> request.id >> frame >> x >> y >> z >> roll >> pitch >> yaw) ||
+				(frame != "local" && frame != "global"))
+			throw runtime_error("Malformed request at " + path + ":" + to_string(line_number));
+
+		string policy;
+		request.path_policy = PATH_CARTESIAN;
+		if (fields >> policy && !parsePathPolicy(policy, request.path_policy))
+			throw runtime_error("Unknown path policy at " + path + ":" + to_string(line_number));
+
+		request.global_reference_frame = frame == "global";
+		request.goal_transform = Eigen::Translation3d(x, y, z) *
+				Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitZ()) *
+				Eigen::AngleAxisd(pitch, Eigen::Vector3d::UnitY()) *
+				Eigen::AngleAxisd(roll, Eigen::Vector3d::UnitX());
+		requests.push_back(request);
+	}
+	return requests;
+}
+
+string formatResult(const PlanningResult& result){
+	ostringstream line;
+	line << result.id << "," << (result.success ? 1 : 0) << "," << result.waypoint_count << "," << result.planning_ms
+	     << "," << result.allocated_bytes << "," << result.peak_live_bytes << "," << result.peak_rss_bytes;
+	return line.str();
+}
+
+bool parseResult(const string& line, PlanningResult& result){
+	istringstream fields(line);
+	string success, waypoint_count, planning_ms, allocated_bytes, peak_live_bytes, peak_rss_bytes;
+	if (!getline(fields, result.id, ',') || !getline(fields, success, ',') ||
+			!getline(fields, waypoint_count, ',') || !getline(fields, planning_ms, ',') ||
+			!getline(fields, allocated_bytes, ',') || !getline(fields, peak_live_bytes, ',') ||
+			!getline(fields, peak_rss_bytes))
+		return false;
+	try {
+		result.success = stoi(success) != 0;
+		result.waypoint_count = stoul(waypoint_count);
+		result.planning_ms = stod(planning_ms);
+		result.allocated_bytes = stoull(allocated_bytes);
+		result.peak_live_bytes = stoll(peak_live_bytes);
+		result.peak_rss_bytes = stoull(peak_rss_bytes);
+	}
+	catch (const logic_error&){
+		return false;
+	}
+	return true;
+}
+
+}
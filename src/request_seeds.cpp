@@ -0,0 +1,103 @@
+#include <kinematics_test/request_seeds.h>
+
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <random_numbers/random_numbers.h>
+
+using namespace std;
+
+namespace kinematics_test {
+
+namespace {
+
+thread_local RequestSeeds* current_seeds = nullptr;
+
+/** 64-bit FNV-1a, std::hash may differ between standard libraries. Keys of thousands of calls don't collide */
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull){
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; ++i){
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+}
+
+RequestSeeds::RequestSeeds(const string& request_id) :
+		request_id_(request_id), request_hash_(hashBytes(request_id.data(), request_id.size())){}
+
+uint64_t RequestSeeds::callKey(const Eigen::Affine3d& pose, const vector<double>& start_positions){
+	uint64_t key = hashBytes(pose.matrix().data(), 16 * sizeof(double));
+	return hashBytes(start_positions.data(), start_positions.size() * sizeof(double), key);
+}
+
+void RequestSeeds::deriveSeed(uint64_t call, size_t attempt, const moveit::core::JointModelGroup* jmg_ptr,
+                              vector<double>& seed) const{
+	uint64_t indices[2] = {call, attempt};
+	//The generator takes 32 bits
+	uint64_t hash = hashBytes(indices, sizeof(indices), request_hash_);
+	random_numbers::RandomNumberGenerator generator((uint32_t)(hash ^ (hash >> 32)));
+	jmg_ptr->getVariableRandomPositions(generator, seed);
+}
+
+bool RequestSeeds::replay(uint64_t call, vector<double>& positions) const{
+	map<uint64_t, vector<double>>::const_iterator recorded = recorded_.find(call);
+	if (recorded == recorded_.end())
+		return false;
+	positions = recorded->second;
+	return true;
+}
+
+void RequestSeeds::record(uint64_t call, const vector<double>& positions){
+	recorded_[call] = positions;
+}
+
+bool RequestSeeds::load(const string& path){
+	ifstream file(path.c_str());
+	if (!file)
+		return false;
+	string line;
+	while (getline(file, line)){
+		istringstream fields(line);
+		uint64_t call;
+		if (!(fields >> call))
+			continue;
+		vector<double>& positions = recorded_[call];
+		positions.clear();
+		double position;
+		while (fields >> position)
+			positions.push_back(position);
+	}
+	return true;
+}
+
+void RequestSeeds::save(const string& path) const{
+	ofstream file(path.c_str());
+	if (!file)
+		throw runtime_error("Can't write IK seeds to " + path);
+	//Enough digits for the values to read back bit-identical
+	file.precision(numeric_limits<double>::max_digits10);
+	for (const pair<const uint64_t, vector<double>>& recorded : recorded_){
+		file << recorded.first;
+		for (double position : recorded.second)
+			file << " " << position;
+		file << "\n";
+	}
+}
+
+SeedRequestScope::SeedRequestScope(RequestSeeds* seeds) : previous_(current_seeds){
+	current_seeds = seeds;
+}
+
+SeedRequestScope::~SeedRequestScope(){
+	current_seeds = previous_;
+}
+
+RequestSeeds* SeedRequestScope::current(){
+	return current_seeds;
+}
+
+}
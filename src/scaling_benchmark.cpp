@@ -0,0 +1,367 @@
+/*********************************************************************
+ * Measures how the pipeline scales with the path, the scene and the
+ * number of threads. Every cell of the matrix plans the same requests:
+ * tool moves of a given length and rotation about random axes, in a
+ * scene cluttered with a given number of random boxes, by a given
+ * number of worker threads with their own planner. Scenes and requests
+ * come from fixed generators, so every version plans the same matrix.
+ *
+ *   scaling_benchmark <results_dir> [--label name] [--requests N] [--obstacles 0,8,32]
+ *                     [--lengths 0.1,0.3] [--angles 0,0.5] [--threads 1,2,4]
+ *   scaling_benchmark --compare <baseline.csv> <candidate.csv>
+ *
+ * A run writes <results_dir>/<label>.csv, one row per cell with the
+ * latency, throughput, waypoint and memory figures, and prints the
+ * speedup of every cell over its fewest threads. The comparison prints
+ * the ratios of two runs for the cells they share.
+ *********************************************************************/
+
+#include <ros/ros.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <random_numbers/random_numbers.h>
+#include <geometric_shapes/shapes.h>
+#include <moveit/robot_model_loader/robot_model_loader.h>
+#include <moveit/planning_scene/planning_scene.h>
+#include <kinematics_test/cartesian_path_planner.h>
+
+#define DEFAULT_ROBOT_DESCRIPTION "robot_description"
+#define DEFAULT_REQUESTS 32
+//Obstacles are boxes with edges between these, m
+#define MIN_OBSTACLE_SIZE 0.05
+#define MAX_OBSTACLE_SIZE 0.25
+//Half width and height of the cell the obstacles are scattered in, m
+#define CELL_HALF_WIDTH 1.5
+#define CELL_HEIGHT 2.0
+
+using namespace std;
+using namespace moveit;
+using namespace core;
+using namespace kinematics_test;
+
+/** Planner of one worker thread, solvers can't be shared between threads */
+struct PlanningContext {
+	robot_model_loader::RobotModelLoaderPtr loader;
+	planning_scene::PlanningScenePtr scene;
+	unique_ptr<CartesianPathPlanner> planner;
+};
+
+struct Obstacle {
+	shapes::ShapeConstPtr shape;
+	Eigen::Affine3d pose;
+
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+struct CellResult {
+	size_t obstacles;
+	double path_length;
+	double rotation;
+	size_t threads;
+	size_t requests;
+	size_t succeeded;
+	double mean_ms;
+	double p50_ms;
+	double p95_ms;
+	double throughput;
+	double mean_waypoints;
+	double allocated_mb;
+	double peak_live_mb;
+	double peak_rss_mb;
+};
+
+vector<double> parseList(const string& text){
+	vector<double> values;
+	istringstream fields(text);
+	string field;
+	while (getline(fields, field, ','))
+		if (!field.empty())
+			values.push_back(atof(field.c_str()));
+	return values;
+}
+
+/** Powers of two below the core count, then all cores */
+vector<double> defaultThreadCounts(){
+	size_t cores = max(1u, thread::hardware_concurrency());
+	vector<double> thread_counts;
+	for (size_t threads = 1; threads < cores; threads *= 2)
+		thread_counts.push_back(threads);
+	thread_counts.push_back(cores);
+	return thread_counts;
+}
+
+Eigen::Vector3d randomAxis(random_numbers::RandomNumberGenerator& generator){
+	Eigen::Vector3d axis;
+	do
+		axis = Eigen::Vector3d(generator.uniformReal(-1, 1), generator.uniformReal(-1, 1), generator.uniformReal(-1, 1));
+	while (axis.norm() < 1e-3 || axis.norm() > 1);
+	return axis.normalized();
+}
+
+/** Random boxes around the robot, the ones colliding with the start state are drawn again */
+vector<Obstacle, Eigen::aligned_allocator<Obstacle>> generateObstacles(size_t count,
+                                                                     planning_scene::PlanningScene& scene,
+                                                                     const robot_state::RobotState& start_state){
+	random_numbers::RandomNumberGenerator generator(count);
+	vector<Obstacle, Eigen::aligned_allocator<Obstacle>> obstacles;
+	while (obstacles.size() < count){
+		Obstacle obstacle;
+		obstacle.shape.reset(new shapes::Box(generator.uniformReal(MIN_OBSTACLE_SIZE, MAX_OBSTACLE_SIZE),
+		                                     generator.uniformReal(MIN_OBSTACLE_SIZE, MAX_OBSTACLE_SIZE),
+		                                     generator.uniformReal(MIN_OBSTACLE_SIZE, MAX_OBSTACLE_SIZE)));
+		obstacle.pose = Eigen::Translation3d(generator.uniformReal(-CELL_HALF_WIDTH, CELL_HALF_WIDTH),
+		                                     generator.uniformReal(-CELL_HALF_WIDTH, CELL_HALF_WIDTH),
+		                                     generator.uniformReal(0, CELL_HEIGHT)) *
+				Eigen::AngleAxisd(generator.uniformReal(-M_PI, M_PI), Eigen::Vector3d::UnitZ());
+		scene.getWorldNonConst()->addToObject("probe", obstacle.shape, obstacle.pose);
+		bool is_colliding = scene.isStateColliding(start_state);
+		scene.getWorldNonConst()->removeObject("probe");
+		if (!is_colliding)
+			obstacles.push_back(obstacle);
+	}
+	return obstacles;
+}
+
+void applyObstacles(planning_scene::PlanningScene& scene,
+                    const vector<Obstacle, Eigen::aligned_allocator<Obstacle>>& obstacles){
+	scene.getWorldNonConst()->clearObjects();
+	for (size_t obstacle_idx = 0; obstacle_idx < obstacles.size(); ++obstacle_idx)
+		scene.getWorldNonConst()->addToObject("obstacle_" + to_string(obstacle_idx), obstacles[obstacle_idx].shape,
+		                                      obstacles[obstacle_idx].pose);
+}
+
+/** Tool frame goals of the given length and rotation, the generator is seeded by the cell */
+vector<Eigen::Affine3d, Eigen::aligned_allocator<Eigen::Affine3d>> generateGoals(size_t count, double path_length,
+                                                                                 double rotation, unsigned int seed){
+	random_numbers::RandomNumberGenerator generator(seed);
+	vector<Eigen::Affine3d, Eigen::aligned_allocator<Eigen::Affine3d>> goals;
+	for (size_t goal_idx = 0; goal_idx < count; ++goal_idx){
+		Eigen::Vector3d direction = randomAxis(generator);
+		Eigen::Vector3d axis = randomAxis(generator);
+		goals.push_back(Eigen::Translation3d(path_length * direction) * Eigen::AngleAxisd(rotation, axis));
+	}
+	return goals;
+}
+
+CellResult runCell(vector<PlanningContext>& contexts, size_t thread_count,
+                   const vector<Eigen::Affine3d, Eigen::aligned_allocator<Eigen::Affine3d>>& goals){
+	vector<double> latencies(goals.size(), 0.0);
+	vector<size_t> waypoint_counts(goals.size(), 0);
+	//Not vector<bool>, the workers write neighbouring elements
+	vector<char> successes(goals.size(), false);
+	vector<uint64_t> allocated_bytes(goals.size(), 0);
+	vector<int64_t> peak_live_bytes(goals.size(), 0);
+
+	atomic<size_t> next_goal(0);
+	vector<thread> workers;
+	chrono::steady_clock::time_point cell_start = chrono::steady_clock::now();
+	for (size_t worker_idx = 0; worker_idx < thread_count; ++worker_idx)
+		workers.push_back(thread([&, worker_idx](){
+			const CartesianPathPlanner& planner = *contexts[worker_idx].planner;
+			//Every worker plans from a state of its own robot model
+			robot_state::RobotState start_state(contexts[worker_idx].loader->getModel());
+			setToStartState(start_state, planner.getConfig());
+			for (size_t goal_idx = next_goal++; goal_idx < goals.size(); goal_idx = next_goal++){
+				Trail trail;
+				RequestMemory memory(planner.getConfig().memory_budget_bytes);
+				RequestSeeds seeds("scaling_" + to_string(goal_idx));
+				SeedRequestScope seed_scope(&seeds);
+				chrono::steady_clock::time_point plan_start = chrono::steady_clock::now();
+				successes[goal_idx] = planner.plan(trail, start_state, goals[goal_idx], false, PATH_CARTESIAN, &memory);
+				latencies[goal_idx] = chrono::duration<double, milli>(chrono::steady_clock::now() - plan_start).count();
+				waypoint_counts[goal_idx] = trail.size();
+				allocated_bytes[goal_idx] = memory.allocated_bytes.load();
+				peak_live_bytes[goal_idx] = memory.peak_live_bytes.load();
+			}
+		}));
+	for (thread& worker : workers)
+		worker.join();
+	double cell_seconds = chrono::duration<double>(chrono::steady_clock::now() - cell_start).count();
+
+	CellResult result = {0, 0.0, 0.0, thread_count, goals.size(), 0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+	size_t waypoints = 0;
+	uint64_t total_allocated = 0;
+	int64_t peak_live = 0;
+	for (size_t goal_idx = 0; goal_idx < goals.size(); ++goal_idx){
+		result.succeeded += successes[goal_idx];
+		result.mean_ms += latencies[goal_idx];
+		waypoints += waypoint_counts[goal_idx];
+		total_allocated += allocated_bytes[goal_idx];
+		peak_live = max(peak_live, peak_live_bytes[goal_idx]);
+	}
+	sort(latencies.begin(), latencies.end());
+	result.mean_ms /= goals.size();
+	result.p50_ms = latencies[latencies.size() / 2];
+	result.p95_ms = latencies[min(latencies.size() - 1, latencies.size() * 95 / 100)];
+	result.throughput = goals.size() / cell_seconds;
+	//Failed requests leave an empty trail, the mean is over the planned ones
+	result.mean_waypoints = result.succeeded ? (double)waypoints / result.succeeded : 0.0;
+	result.allocated_mb = total_allocated / 1048576.0 / goals.size();
+	result.peak_live_mb = peak_live / 1048576.0;
+	//High-water mark of the process, it only grows over the run
+	result.peak_rss_mb = getPeakRssBytes() / 1048576.0;
+	return result;
+}
+
+const char* RESULT_HEADER = "label,obstacles,path_length,rotation,threads,requests,succeeded,mean_ms,p50_ms,p95_ms,"
+		"throughput,mean_waypoints,allocated_mb,peak_live_mb,peak_rss_mb";
+
+void writeResult(ostream& output, const string& label, const CellResult& result){
+	output << label << "," << result.obstacles << "," << result.path_length << "," << result.rotation << ","
+	       << result.threads << "," << result.requests << "," << result.succeeded << "," << result.mean_ms << ","
+	       << result.p50_ms << "," << result.p95_ms << "," << result.throughput << "," << result.mean_waypoints << ","
+	       << result.allocated_mb << "," << result.peak_live_mb << "," << result.peak_rss_mb << "\n";
+}
+
+/** Rows of a results file by cell, the label column is dropped */
+map<string, CellResult> loadResults(const string& path){
+	ifstream file(path.c_str());
+	if (!file)
+		throw runtime_error("Can't open results " + path);
+	map<string, CellResult> results;
+	string line;
+	getline(file, line);
+	while (getline(file, line)){
+		istringstream fields(line);
+		string label;
+		CellResult result;
+		char comma;
+		getline(fields, label, ',');
+		if (!(fields >> result.obstacles >> comma >> result.path_length >> comma >> result.rotation >> comma
+		             >> result.threads >> comma >> result.requests >> comma >> result.succeeded >> comma
+		             >> result.mean_ms >> comma >> result.p50_ms >> comma >> result.p95_ms >> comma
+		             >> result.throughput >> comma >> result.mean_waypoints >> comma >> result.allocated_mb >> comma
+		             >> result.peak_live_mb >> comma >> result.peak_rss_mb))
+			continue;
+		ostringstream key;
+		key << result.obstacles << " obstacles, " << result.path_length << " m, " << result.rotation << " rad, "
+		    << result.threads << " threads";
+		results[key.str()] = result;
+	}
+	return results;
+}
+
+int compareResults(const string& baseline_path, const string& candidate_path){
+	map<string, CellResult> baseline = loadResults(baseline_path);
+	map<string, CellResult> candidate = loadResults(candidate_path);
+	size_t shared_cells = 0;
+	for (const pair<const string, CellResult>& entry : candidate){
+		map<string, CellResult>::const_iterator reference = baseline.find(entry.first);
+		if (reference == baseline.end())
+			continue;
+		shared_cells++;
+		const CellResult& before = reference->second;
+		const CellResult& after = entry.second;
+		printf("%s: p50 x%.2f, p95 x%.2f, throughput x%.2f, waypoints %.1f -> %.1f, allocated x%.2f, "
+		       "succeeded %lu -> %lu\n", entry.first.c_str(), after.p50_ms / before.p50_ms,
+		       after.p95_ms / before.p95_ms, after.throughput / before.throughput, before.mean_waypoints,
+		       after.mean_waypoints, after.allocated_mb / before.allocated_mb, before.succeeded, after.succeeded);
+	}
+	printf("Cells compared: %lu\n", shared_cells);
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	ros::init(argc, argv, "scaling_benchmark");
+	if (argc == 4 && string(argv[1]) == "--compare")
+		return compareResults(argv[2], argv[3]);
+	if (argc < 2){
+		fprintf(stderr, "Usage: scaling_benchmark <results_dir> [--label name] [--requests N] [--obstacles 0,8,32] "
+		        "[--lengths 0.1,0.3] [--angles 0,0.5] [--threads 1,2,4]\n"
+		        "       scaling_benchmark --compare <baseline.csv> <candidate.csv>\n");
+		return 1;
+	}
+	string label = "current";
+	size_t request_count = DEFAULT_REQUESTS;
+	vector<double> obstacle_counts = {0, 8, 32, 128};
+	vector<double> path_lengths = {0.05, 0.2, 0.5};
+	vector<double> rotations = {0.0, 0.5, 1.5};
+	vector<double> thread_counts = defaultThreadCounts();
+	for (int arg_idx = 2; arg_idx + 1 < argc; arg_idx += 2){
+		string option = argv[arg_idx];
+		if (option == "--label")
+			label = argv[arg_idx + 1];
+		else if (option == "--requests")
+			request_count = max(1, atoi(argv[arg_idx + 1]));
+		else if (option == "--obstacles")
+			obstacle_counts = parseList(argv[arg_idx + 1]);
+		else if (option == "--lengths")
+			path_lengths = parseList(argv[arg_idx + 1]);
+		else if (option == "--angles")
+			rotations = parseList(argv[arg_idx + 1]);
+		else if (option == "--threads")
+			thread_counts = parseList(argv[arg_idx + 1]);
+	}
+	sort(thread_counts.begin(), thread_counts.end());
+	if (thread_counts.empty() || thread_counts.front() < 1){
+		fprintf(stderr, "Thread counts must be positive\n");
+		return 1;
+	}
+
+	string results_path = string(argv[1]) + "/" + label + ".csv";
+	ofstream results(results_path.c_str());
+	if (!results){
+		fprintf(stderr, "Can't write %s\n", results_path.c_str());
+		return 1;
+	}
+	results << RESULT_HEADER << "\n";
+
+	ros::NodeHandle node_handle;
+	PlannerConfig config;
+	loadPlannerConfig(ros::NodeHandle("~"), config);
+
+	//Loaders are created one by one, pluginlib isn't safe to use concurrently
+	vector<PlanningContext> contexts((size_t)thread_counts.back());
+	for (PlanningContext& context : contexts){
+		context.loader.reset(new robot_model_loader::RobotModelLoader(DEFAULT_ROBOT_DESCRIPTION));
+		context.scene.reset(new planning_scene::PlanningScene(context.loader->getModel()));
+		context.planner.reset(new CartesianPathPlanner(context.loader->getModel(), context.scene, config));
+	}
+	for (PlanningContext& context : contexts){
+		robot_state::RobotState warm_up_state(context.loader->getModel());
+		setToStartState(warm_up_state, config);
+		context.planner->warmUp(warm_up_state);
+	}
+	robot_state::RobotState start_state(contexts.front().loader->getModel());
+	setToStartState(start_state, config);
+
+	for (double obstacle_count : obstacle_counts){
+		vector<Obstacle, Eigen::aligned_allocator<Obstacle>> obstacles =
+				generateObstacles(obstacle_count, *contexts.front().scene, start_state);
+		for (PlanningContext& context : contexts)
+			applyObstacles(*context.scene, obstacles);
+
+		for (size_t length_idx = 0; length_idx < path_lengths.size(); ++length_idx)
+			for (size_t rotation_idx = 0; rotation_idx < rotations.size(); ++rotation_idx){
+				//Seeded by the values, not the positions, so runs with other lists share their cells
+				unsigned int seed = path_lengths[length_idx] * 1000 + rotations[rotation_idx] * 1000000;
+				vector<Eigen::Affine3d, Eigen::aligned_allocator<Eigen::Affine3d>> goals =
+						generateGoals(request_count, path_lengths[length_idx], rotations[rotation_idx], seed);
+				double base_throughput = 0;
+				for (double thread_count : thread_counts){
+					CellResult result = runCell(contexts, thread_count, goals);
+					result.obstacles = obstacle_count;
+					result.path_length = path_lengths[length_idx];
+					result.rotation = rotations[rotation_idx];
+					if (!base_throughput)
+						base_throughput = result.throughput;
+					writeResult(results, label, result);
+					results.flush();
+					printf("%lu obstacles, %.2f m, %.2f rad, %lu threads: p50 %.2f ms, p95 %.2f ms, "
+					       "%.1f requests/s (x%.2f), %.1f waypoints, %.2f MB allocated, succeeded %lu of %lu\n",
+					       result.obstacles, result.path_length, result.rotation, result.threads, result.p50_ms,
+					       result.p95_ms, result.throughput, result.throughput / base_throughput,
+					       result.mean_waypoints, result.allocated_mb, result.succeeded, result.requests);
+				}
+			}
+	}
+	printf("Results: %s\n", results_path.c_str());
+	return 0;
+}
@@ -0,0 +1,433 @@
+/*********************************************************************
+ * Orders a weld program to minimize the estimated cycle time. Every seam
+ * may be welded in either direction and from any IK branch of its entry
+ * pose, so the ordering is a generalized TSP over clusters of
+ * (seam, direction, branch) nodes starting and ending at the start state.
+ *
+ * Seams are planned once through the Cartesian pipeline by worker
+ * threads with their own robot model and kinematics solvers, and the
+ * cached plans serve both the cost matrix and the emitted program. Move
+ * times are the joint space lower bound max |dq| / max velocity. The
+ * tour is built greedily, then improved by segment reversals with the
+ * node of every cluster reselected by dynamic programming.
+ *
+ * A seam file has one seam per line, both poses in the model frame:
+ *   <id> <x y z roll pitch yaw of one end> <x y z roll pitch yaw of the other>
+ *
+ *   sequence_optimizer <seams> <program.csv> [--workers N] [--branches K] [--scene file]
+ *
+ * The program lists the joint positions of every waypoint, transfers
+ * are planned in joint space to the entry state of the next seam. When
+ * a transfer can't be planned no program is written. --scene loads the
+ * world of the cell from a .scene file, without it seams and transfers
+ * are only checked for self collisions.
+ *********************************************************************/
+
+#include <ros/ros.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <random_numbers/random_numbers.h>
+#include <moveit/robot_model_loader/robot_model_loader.h>
+#include <moveit/planning_scene/planning_scene.h>
+#include <kinematics_test/cartesian_path_planner.h>
+#include <kinematics_test/startup_loading.h>
+
+#define DEFAULT_ROBOT_DESCRIPTION "robot_description"
+#define DEFAULT_BRANCHES 4
+#define BRANCH_SEARCH_ATTEMPTS 40
+//Two IK solutions closer than this in every joint are the same branch
+#define BRANCH_SEPARATION 0.5
+//Used for joints without a velocity limit in the URDF, rad/s
+#define DEFAULT_JOINT_VELOCITY 1.0
+
+using namespace std;
+using namespace moveit;
+using namespace core;
+using namespace kinematics_test;
+
+typedef vector<double> JointPositions;
+
+struct Seam {
+	string id;
+	Eigen::Affine3d ends[2];
+};
+
+/** A seam welded in one direction from one IK branch. Node 0 is the start state, its seam is empty */
+struct SequenceNode {
+	size_t seam_idx;
+	bool reversed;
+	size_t branch;
+	vector<JointPositions> waypoints;
+	double seam_seconds;
+};
+
+/** Waypoints of one transfer or seam of the program */
+struct ProgramSegment {
+	string seam_id;
+	const char* kind;
+	vector<JointPositions> waypoints;
+};
+
+/** Planner of one worker thread, solvers can't be shared between threads */
+struct PlanningContext {
+	robot_model_loader::RobotModelLoaderPtr loader;
+	planning_scene::PlanningScenePtr scene;
+	unique_ptr<CartesianPathPlanner> planner;
+};
+
+Eigen::Affine3d parsePose(istream& fields){
+	double x, y, z, roll, pitch, yaw;
+	if (!(fields >> x >> y >> z >> roll >> pitch >> yaw))
+		throw runtime_error("Malformed pose");
+	return Eigen::Translation3d(x, y, z) *
+			Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitZ()) *
+			Eigen::AngleAxisd(pitch, Eigen::Vector3d::UnitY()) *
+			Eigen::AngleAxisd(roll, Eigen::Vector3d::UnitX());
+}
+
+vector<Seam> loadSeams(const string& path){
+	ifstream file(path.c_str());
+	if (!file)
+		throw runtime_error("Can't open seam file " + path);
+	vector<Seam> seams;
+	string line;
+	while (getline(file, line)){
+		if (line.empty() || line[0] == '#')
+			continue;
+		istringstream fields(line);
+		Seam seam;
+		fields >> seam.id;
+		seam.ends[0] = parsePose(fields);
+		seam.ends[1] = parsePose(fields);
+		seams.push_back(seam);
+	}
+	return seams;
+}
+
+vector<double> getMaxVelocities(const robot_state::JointModelGroup* jmg_ptr){
+	vector<double> velocities;
+	for (const robot_state::JointModel* joint : jmg_ptr->getActiveJointModels())
+		for (const robot_state::VariableBounds& bounds : joint->getVariableBounds())
+			velocities.push_back(bounds.velocity_bounded_ && bounds.max_velocity_ > 0 ?
+			                     bounds.max_velocity_ : DEFAULT_JOINT_VELOCITY);
+	return velocities;
+}
+
+/** Lower bound of the time of a synchronized joint move */
+double estimateMoveSeconds(const JointPositions& from, const JointPositions& to, const vector<double>& max_velocities){
+	double seconds = 0;
+	for (size_t joint_idx = 0; joint_idx < from.size(); ++joint_idx)
+		seconds = max(seconds, fabs(to[joint_idx] - from[joint_idx]) / max_velocities[joint_idx]);
+	return seconds;
+}
+
+/** Distinct IK solutions of the pose from random seeds, a fixed generator keeps runs comparable */
+vector<JointPositions> findBranches(robot_state::RobotState& kinematic_state, const Eigen::Affine3d& pose,
+                                    const PlannerConfig& config, size_t branch_count){
+	const robot_state::JointModelGroup* jmg_ptr = kinematic_state.getJointModelGroup(config.planning_group);
+	random_numbers::RandomNumberGenerator generator(0);
+	vector<JointPositions> branches;
+	for (size_t attempt = 0; attempt < BRANCH_SEARCH_ATTEMPTS && branches.size() < branch_count; ++attempt){
+		JointPositions seed;
+		jmg_ptr->getVariableRandomPositions(generator, seed);
+		kinematic_state.setJointGroupPositions(jmg_ptr, seed);
+		if (!kinematic_state.setFromIK(jmg_ptr, pose, config.end_effector, 1, config.ik_timeout))
+			continue;
+		JointPositions solution;
+		kinematic_state.copyJointGroupPositions(jmg_ptr, solution);
+		bool is_new = true;
+		for (const JointPositions& branch : branches){
+			double separation = 0;
+			for (size_t joint_idx = 0; joint_idx < solution.size(); ++joint_idx)
+				separation = max(separation, fabs(solution[joint_idx] - branch[joint_idx]));
+			is_new &= separation > BRANCH_SEPARATION;
+		}
+		if (is_new)
+			branches.push_back(solution);
+	}
+	return branches;
+}
+
+/** Plan one direction of a seam from every branch of its entry pose */
+vector<SequenceNode> planSeamDirection(PlanningContext& context, const vector<Seam>& seams, size_t seam_idx,
+                                       bool reversed, size_t branch_count, const vector<double>& max_velocities){
+	const PlannerConfig& config = context.planner->getConfig();
+	robot_state::RobotState kinematic_state(context.loader->getModel());
+	kinematic_state.setToDefaultValues();
+	const robot_state::JointModelGroup* jmg_ptr = kinematic_state.getJointModelGroup(config.planning_group);
+	const Seam& seam = seams[seam_idx];
+
+	vector<SequenceNode> nodes;
+	vector<JointPositions> branches = findBranches(kinematic_state, seam.ends[reversed], config, branch_count);
+	for (size_t branch = 0; branch < branches.size(); ++branch){
+		kinematic_state.setJointGroupPositions(jmg_ptr, branches[branch]);
+		kinematic_state.update();
+		Trail trail;
+		RequestSeeds seeds(seam.id + (reversed ? "_reversed_" : "_forward_") + to_string(branch));
+		SeedRequestScope seed_scope(&seeds);
+		if (!context.planner->plan(trail, kinematic_state, seam.ends[!reversed]))
+			continue;
+
+		SequenceNode node = {seam_idx, reversed, branch, {}, 0.0};
+		for (const robot_state::RobotStatePtr& state : trail){
+			node.waypoints.push_back(JointPositions());
+			state->copyJointGroupPositions(jmg_ptr, node.waypoints.back());
+			if (node.waypoints.size() > 1)
+				node.seam_seconds += estimateMoveSeconds(node.waypoints[node.waypoints.size() - 2],
+				                                         node.waypoints.back(), max_velocities);
+		}
+		nodes.push_back(node);
+	}
+	return nodes;
+}
+
+/** Best node of every cluster for a fixed cluster order, a shortest path through the layered graph.
+ * The tour starts and ends at node 0 */
+double optimizeNodes(const vector<size_t>& order, const vector<vector<size_t>>& clusters,
+                     const vector<vector<double>>& costs, vector<size_t>& chosen_nodes){
+	vector<vector<double>> tour_costs(order.size());
+	vector<vector<size_t>> previous(order.size());
+	for (size_t position = 0; position < order.size(); ++position){
+		const vector<size_t>& cluster = clusters[order[position]];
+		tour_costs[position].assign(cluster.size(), numeric_limits<double>::infinity());
+		previous[position].assign(cluster.size(), 0);
+		for (size_t node_idx = 0; node_idx < cluster.size(); ++node_idx){
+			if (position == 0){
+				tour_costs[0][node_idx] = costs[0][cluster[node_idx]];
+				continue;
+			}
+			const vector<size_t>& previous_cluster = clusters[order[position - 1]];
+			for (size_t previous_idx = 0; previous_idx < previous_cluster.size(); ++previous_idx){
+				double cost = tour_costs[position - 1][previous_idx] +
+						costs[previous_cluster[previous_idx]][cluster[node_idx]];
+				if (cost < tour_costs[position][node_idx]){
+					tour_costs[position][node_idx] = cost;
+					previous[position][node_idx] = previous_idx;
+				}
+			}
+		}
+	}
+
+	const vector<size_t>& last_cluster = clusters[order.back()];
+	double best_cost = numeric_limits<double>::infinity();
+	size_t best_idx = 0;
+	for (size_t node_idx = 0; node_idx < last_cluster.size(); ++node_idx){
+		double cost = tour_costs.back()[node_idx] + costs[last_cluster[node_idx]][0];
+		if (cost < best_cost){
+			best_cost = cost;
+			best_idx = node_idx;
+		}
+	}
+	chosen_nodes.assign(order.size(), 0);
+	for (size_t position = order.size(); position-- > 0;){
+		chosen_nodes[position] = clusters[order[position]][best_idx];
+		best_idx = previous[position][best_idx];
+	}
+	return best_cost;
+}
+
+/** Nearest neighbour over the clusters, then 2-opt reversals of the cluster order until no reversal helps */
+vector<size_t> sequenceClusters(const vector<vector<size_t>>& clusters, const vector<vector<double>>& costs){
+	vector<size_t> order;
+	vector<bool> visited(clusters.size(), false);
+	size_t current_node = 0;
+	for (size_t position = 0; position < clusters.size(); ++position){
+		double best_cost = numeric_limits<double>::infinity();
+		size_t best_cluster = 0, best_node = 0;
+		for (size_t cluster_idx = 0; cluster_idx < clusters.size(); ++cluster_idx)
+			if (!visited[cluster_idx])
+				for (size_t node : clusters[cluster_idx])
+					if (costs[current_node][node] < best_cost){
+						best_cost = costs[current_node][node];
+						best_cluster = cluster_idx;
+						best_node = node;
+					}
+		visited[best_cluster] = true;
+		order.push_back(best_cluster);
+		current_node = best_node;
+	}
+
+	vector<size_t> chosen_nodes;
+	double best_cost = optimizeNodes(order, clusters, costs, chosen_nodes);
+	bool is_improved = true;
+	while (is_improved){
+		is_improved = false;
+		for (size_t first = 0; first + 1 < order.size(); ++first)
+			for (size_t last = first + 1; last < order.size(); ++last){
+				vector<size_t> candidate = order;
+				reverse(candidate.begin() + first, candidate.begin() + last + 1);
+				double cost = optimizeNodes(candidate, clusters, costs, chosen_nodes);
+				if (cost < best_cost - 1e-9){
+					best_cost = cost;
+					order = candidate;
+					is_improved = true;
+				}
+			}
+	}
+	return order;
+}
+
+void writeSegment(ofstream& program, size_t segment, const ProgramSegment& program_segment){
+	for (const JointPositions& positions : program_segment.waypoints){
+		program << segment << "," << program_segment.seam_id << "," << program_segment.kind;
+		for (double position : positions)
+			program << "," << position;
+		program << "\n";
+	}
+}
+
+int main(int argc, char** argv)
+{
+	ros::init(argc, argv, "sequence_optimizer");
+	if (argc < 3){
+		fprintf(stderr, "Usage: sequence_optimizer <seams> <program.csv> [--workers N] [--branches K] [--scene file]\n");
+		return 1;
+	}
+	size_t worker_count = max(1u, thread::hardware_concurrency());
+	size_t branch_count = DEFAULT_BRANCHES;
+	string scene_path;
+	for (int arg_idx = 3; arg_idx + 1 < argc; arg_idx += 2){
+		string option = argv[arg_idx];
+		if (option == "--workers")
+			worker_count = max(1, atoi(argv[arg_idx + 1]));
+		else if (option == "--branches")
+			branch_count = max(1, atoi(argv[arg_idx + 1]));
+		else if (option == "--scene")
+			scene_path = argv[arg_idx + 1];
+	}
+
+	vector<Seam> seams = loadSeams(argv[1]);
+	if (seams.empty()){
+		fprintf(stderr, "No seams in %s\n", argv[1]);
+		return 1;
+	}
+	ros::NodeHandle node_handle;
+	PlannerConfig config;
+	loadPlannerConfig(ros::NodeHandle("~"), config);
+
+	if (scene_path.empty())
+		ROS_WARN("No --scene given, seams and transfers are only checked for self collisions");
+
+	//Loaders are created one by one, pluginlib isn't safe to use concurrently
+	vector<PlanningContext> contexts(min(worker_count, 2 * seams.size()));
+	for (PlanningContext& context : contexts){
+		context.loader.reset(new robot_model_loader::RobotModelLoader(DEFAULT_ROBOT_DESCRIPTION));
+		context.scene.reset(new planning_scene::PlanningScene(context.loader->getModel()));
+		if (!scene_path.empty()){
+			try {
+				loadSceneGeometry(*context.scene, scene_path);
+			}
+			catch (const runtime_error& error){
+				ROS_ERROR("%s", error.what());
+				return 1;
+			}
+		}
+		context.planner.reset(new CartesianPathPlanner(context.loader->getModel(), context.scene, config));
+	}
+	robot_model::RobotModelConstPtr kt_kinematic_model = contexts.front().loader->getModel();
+	const robot_state::JointModelGroup* jmg_ptr = kt_kinematic_model->getJointModelGroup(config.planning_group);
+	vector<double> max_velocities = getMaxVelocities(jmg_ptr);
+
+	robot_state::RobotState start_state(kt_kinematic_model);
+	setToStartState(start_state, config);
+	SequenceNode start_node = {seams.size(), false, 0, {JointPositions()}, 0.0};
+	start_state.copyJointGroupPositions(jmg_ptr, start_node.waypoints.front());
+
+	//Every seam direction is one work item, its plans are cached for the program
+	vector<vector<SequenceNode>> seam_plans(2 * seams.size());
+	atomic<size_t> next_item(0);
+	vector<thread> workers;
+	for (PlanningContext& context : contexts)
+		workers.push_back(thread([&](){
+			for (size_t item = next_item++; item < seam_plans.size(); item = next_item++)
+				seam_plans[item] = planSeamDirection(context, seams, item / 2, item % 2, branch_count, max_velocities);
+		}));
+	for (thread& worker : workers)
+		worker.join();
+
+	vector<SequenceNode> nodes(1, start_node);
+	vector<vector<size_t>> clusters;
+	for (size_t seam_idx = 0; seam_idx < seams.size(); ++seam_idx){
+		vector<size_t> cluster;
+		for (size_t direction = 0; direction < 2; ++direction)
+			for (const SequenceNode& node : seam_plans[2 * seam_idx + direction]){
+				cluster.push_back(nodes.size());
+				nodes.push_back(node);
+			}
+		if (cluster.empty())
+			ROS_ERROR("Seam %s can't be welded from any branch, it is left out", seams[seam_idx].id.c_str());
+		else
+			clusters.push_back(cluster);
+	}
+	if (clusters.empty())
+		return 1;
+
+	//Cost of a node is the transfer to its entry plus the seam itself
+	vector<vector<double>> costs(nodes.size(), vector<double>(nodes.size(), 0.0));
+	for (size_t from = 0; from < nodes.size(); ++from)
+		for (size_t to = 0; to < nodes.size(); ++to)
+			costs[from][to] = estimateMoveSeconds(nodes[from].waypoints.back(), nodes[to].waypoints.front(),
+			                                      max_velocities) + nodes[to].seam_seconds;
+
+	vector<size_t> file_order(clusters.size()), chosen_nodes;
+	for (size_t position = 0; position < file_order.size(); ++position)
+		file_order[position] = position;
+	double file_order_seconds = optimizeNodes(file_order, clusters, costs, chosen_nodes);
+	vector<size_t> order = sequenceClusters(clusters, costs);
+	double optimized_seconds = optimizeNodes(order, clusters, costs, chosen_nodes);
+
+	//Transfers go through the pipeline too, the seams come from the cache
+	CartesianPathPlanner& planner = *contexts.front().planner;
+	robot_state::RobotState entry_state(start_state);
+	robot_state::RobotState current_state(start_state);
+	vector<ProgramSegment> program_segments;
+	size_t failed_transfers = 0;
+	chosen_nodes.push_back(0);
+	for (size_t node_idx : chosen_nodes){
+		const SequenceNode& node = nodes[node_idx];
+		const string& seam_id = node_idx ? seams[node.seam_idx].id : string("start");
+		entry_state.setJointGroupPositions(jmg_ptr, node.waypoints.front());
+		entry_state.update();
+		Trail transfer;
+		if (!planner.planJointMove(transfer, current_state, entry_state)){
+			ROS_ERROR("Transfer to %s is invalid", seam_id.c_str());
+			failed_transfers++;
+		}
+		ProgramSegment transfer_segment = {seam_id, "transfer", {}};
+		for (const robot_state::RobotStatePtr& state : transfer){
+			transfer_segment.waypoints.push_back(JointPositions());
+			state->copyJointGroupPositions(jmg_ptr, transfer_segment.waypoints.back());
+		}
+		program_segments.push_back(transfer_segment);
+		if (node_idx){
+			program_segments.push_back(ProgramSegment{seam_id, "seam", node.waypoints});
+			printf("%s %s, branch %lu, %.2f s\n", seam_id.c_str(), node.reversed ? "reversed" : "forward",
+			       node.branch, node.seam_seconds);
+		}
+		current_state.setJointGroupPositions(jmg_ptr, node.waypoints.back());
+		current_state.update();
+	}
+
+	printf("Seams: %lu of %lu, nodes: %lu\n", clusters.size(), seams.size(), nodes.size() - 1);
+	printf("Estimated cycle time: file order %.2f s, optimized %.2f s\n", file_order_seconds, optimized_seconds);
+	//A sequence with a gap can't be executed, a previous program stays as it was
+	if (failed_transfers){
+		ROS_ERROR("%lu transfers can't be planned, no program is written to %s", failed_transfers, argv[2]);
+		return 1;
+	}
+
+	ofstream program(argv[2]);
+	program << "segment,seam,kind";
+	for (const string& name : jmg_ptr->getVariableNames())
+		program << "," << name;
+	program << "\n";
+	for (size_t segment = 0; segment < program_segments.size(); ++segment)
+		writeSegment(program, segment, program_segments[segment]);
+	return 0;
+}
@@ -0,0 +1,144 @@
+#include <kinematics_test/startup_loading.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#include <moveit/collision_detection_fcl/collision_common.h>
+#include <moveit/kinematics_plugin_loader/kinematics_plugin_loader.h>
+
+using namespace std;
+using namespace moveit;
+using namespace core;
+
+namespace kinematics_test {
+
+namespace {
+
+typedef pair<const robot_state::LinkModel*, size_t> LinkShape;
+
+/** Solver of one group, what RobotModelLoader::loadKinematicsSolvers does for every group. The plugin loader is
+ * kept in the planning model, the solver must not outlive it */
+void loadGroupSolver(PlanningModel& planning_model, const string& robot_description, const string& planning_group){
+	const robot_model_loader::RobotModelLoader& loader = *planning_model.loader;
+	planning_model.kinematics_loader.reset(new kinematics_plugin_loader::KinematicsPluginLoader(robot_description));
+	const kinematics_plugin_loader::KinematicsPluginLoaderPtr& kinematics_loader = planning_model.kinematics_loader;
+	robot_model::SolverAllocatorFn allocator = kinematics_loader->getLoaderFunction(loader.getSRDF());
+	map<string, robot_model::SolverAllocatorFn> allocators;
+	allocators[planning_group] = allocator;
+	loader.getModel()->setKinematicsAllocators(allocators);
+
+	robot_model::JointModelGroup* jmg_ptr = loader.getModel()->getJointModelGroup(planning_group);
+	const map<string, double>& timeouts = kinematics_loader->getIKTimeout();
+	map<string, double>::const_iterator timeout = timeouts.find(planning_group);
+	if (timeout != timeouts.end())
+		jmg_ptr->setDefaultIKTimeout(timeout->second);
+	const map<string, unsigned int>& attempts = kinematics_loader->getIKAttempts();
+	map<string, unsigned int>::const_iterator attempt = attempts.find(planning_group);
+	if (attempt != attempts.end())
+		jmg_ptr->setDefaultIKAttempts(attempt->second);
+}
+
+/** BVHs of the shapes, built by worker threads into the FCL shape cache */
+size_t buildCollisionGeometry(const vector<LinkShape>& link_shapes){
+	size_t worker_count = min<size_t>(max(1u, thread::hardware_concurrency()), link_shapes.size());
+	atomic<size_t> next_shape(0);
+	vector<thread> workers;
+	for (size_t worker_idx = 0; worker_idx < worker_count; ++worker_idx)
+		workers.push_back(thread([&](){
+			for (size_t shape_idx = next_shape++; shape_idx < link_shapes.size(); shape_idx = next_shape++){
+				const LinkShape& link_shape = link_shapes[shape_idx];
+				collision_detection::createCollisionGeometry(link_shape.first->getShapes()[link_shape.second],
+				                                             link_shape.first, link_shape.second);
+			}
+		}));
+	for (thread& worker : workers)
+		worker.join();
+	return worker_count;
+}
+
+}
+
+StartupReport::StartupReport() : start_(chrono::steady_clock::now()){}
+
+void StartupReport::add(const string& name, chrono::steady_clock::time_point start,
+                        chrono::steady_clock::time_point end){
+	StartupPhase phase = {name, chrono::duration<double, milli>(start - start_).count(),
+	                      chrono::duration<double, milli>(end - start).count()};
+	lock_guard<mutex> lock(mutex_);
+	phases_.push_back(phase);
+}
+
+vector<StartupPhase> StartupReport::getPhases() const{
+	lock_guard<mutex> lock(mutex_);
+	return phases_;
+}
+
+double StartupReport::getElapsedMs() const{
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - start_).count();
+}
+
+void StartupReport::log() const{
+	vector<StartupPhase> phases = getPhases();
+	sort(phases.begin(), phases.end(), [](const StartupPhase& first, const StartupPhase& second){
+		return first.start_ms < second.start_ms;
+	});
+	ROS_INFO("Startup took %.1f ms", getElapsedMs());
+	for (const StartupPhase& phase : phases)
+		ROS_INFO("  %-20s %8.1f ms at +%.1f ms", phase.name.c_str(), phase.duration_ms, phase.start_ms);
+}
+
+StartupPhaseScope::StartupPhaseScope(StartupReport* report, const string& name) :
+		report_(report), name_(name), start_(chrono::steady_clock::now()){}
+
+StartupPhaseScope::~StartupPhaseScope(){
+	if (report_)
+		report_->add(name_, start_, chrono::steady_clock::now());
+}
+
+PlanningModel loadPlanningModel(const string& robot_description, const string& planning_group,
+                                StartupReport* report){
+	PlanningModel planning_model;
+	{
+		StartupPhaseScope phase(report, "model");
+		robot_model_loader::RobotModelLoader::Options options(robot_description);
+		options.load_kinematics_solvers_ = false;
+		planning_model.loader.reset(new robot_model_loader::RobotModelLoader(options));
+	}
+	const robot_model::RobotModelPtr& model = planning_model.loader->getModel();
+	if (!model || !model->hasJointModelGroup(planning_group))
+		throw runtime_error("Planning group " + planning_group + " isn't in " + robot_description);
+
+	//pluginlib is used by the solver only, the geometry workers don't touch it
+	future<void> solver = async(launch::async, [&](){
+		StartupPhaseScope phase(report, "kinematics_solver");
+		loadGroupSolver(planning_model, robot_description, planning_group);
+	});
+	vector<LinkShape> link_shapes;
+	for (const robot_state::LinkModel* link : model->getJointModelGroup(planning_group)->getLinkModels())
+		for (size_t shape_idx = 0; shape_idx < link->getShapes().size(); ++shape_idx)
+			link_shapes.push_back(LinkShape(link, shape_idx));
+	{
+		StartupPhaseScope phase(report, "group_geometry");
+		size_t worker_count = buildCollisionGeometry(link_shapes);
+		ROS_DEBUG("Collision geometry of %lu group shapes built by %lu threads", link_shapes.size(), worker_count);
+	}
+	solver.get();
+
+	{
+		StartupPhaseScope phase(report, "scene");
+		planning_model.scene_monitor.reset(new planning_scene_monitor::PlanningSceneMonitor(planning_model.loader));
+	}
+	return planning_model;
+}
+
+void loadSceneGeometry(planning_scene::PlanningScene& scene, const string& scene_path){
+	ifstream scene_file(scene_path.c_str());
+	if (!scene_file || !scene.loadGeometryFromStream(scene_file))
+		throw runtime_error("Can't load the scene geometry from " + scene_path);
+	ROS_INFO("%lu collision objects loaded from %s", scene.getWorld()->size(), scene_path.c_str());
+}
+
+}
@@ -0,0 +1,164 @@
+#include <kinematics_test/trace_log.h>
+
+#include <ros/ros.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+using namespace std;
+
+namespace kinematics_test {
+
+namespace {
+
+/** Gives the ring back to the logger when the owning thread exits, so short-lived workers reuse rings */
+struct RingLease {
+	TraceRing* ring = nullptr;
+	~RingLease(){
+		if (ring)
+			ring->in_use.store(false, memory_order_release);
+	}
+};
+
+thread_local RingLease ring_lease;
+
+void emit(const TraceRecord& record){
+	switch (record.event){
+		case TRACE_LINK_TRANSLATION:
+			ROS_INFO("%s translate : %f", record.subject, record.value);
+			break;
+		case TRACE_LINK_BISECTION:
+			ROS_WARN("%s has to great translation: %f", record.subject, record.value);
+			break;
+		default:
+			ROS_WARN("Unknown trace event %d", (int)record.event);
+	}
+}
+
+}
+
+TraceRing::TraceRing() : in_use(true), dropped(0), records_(KT_TRACE_RING_CAPACITY), head_(0), tail_(0){}
+
+bool TraceRing::push(const TraceRecord& record){
+	size_t head = head_.load(memory_order_relaxed);
+	if (head - tail_.load(memory_order_acquire) == KT_TRACE_RING_CAPACITY){
+		dropped.fetch_add(1, memory_order_relaxed);
+		return false;
+	}
+	records_[head % KT_TRACE_RING_CAPACITY] = record;
+	head_.store(head + 1, memory_order_release);
+	return true;
+}
+
+bool TraceRing::pop(TraceRecord& record){
+	size_t tail = tail_.load(memory_order_relaxed);
+	if (tail == head_.load(memory_order_acquire))
+		return false;
+	record = records_[tail % KT_TRACE_RING_CAPACITY];
+	tail_.store(tail + 1, memory_order_release);
+	return true;
+}
+
+TraceLogger& TraceLogger::instance(){
+	static TraceLogger logger;
+	return logger;
+}
+
+TraceLogger::TraceLogger() : running_(false), dropped_records_(0){}
+
+TraceLogger::~TraceLogger(){
+	stop();
+}
+
+void TraceLogger::start(){
+	if (running_.exchange(true))
+		return;
+	flush_thread_ = thread(&TraceLogger::flushLoop, this);
+}
+
+void TraceLogger::stop(){
+	if (running_.exchange(false))
+		flush_thread_.join();
+	drain();
+}
+
+TraceRing* TraceLogger::acquireRing(){
+	lock_guard<mutex> lock(rings_mutex_);
+	for (unique_ptr<TraceRing>& ring : rings_){
+		bool expected = false;
+		if (ring->in_use.compare_exchange_strong(expected, true, memory_order_acquire))
+			return ring.get();
+	}
+	rings_.push_back(unique_ptr<TraceRing>(new TraceRing()));
+	return rings_.back().get();
+}
+
+void TraceLogger::reserveRings(size_t count){
+	lock_guard<mutex> lock(rings_mutex_);
+	while (rings_.size() < count){
+		rings_.push_back(unique_ptr<TraceRing>(new TraceRing()));
+		rings_.back()->in_use.store(false, memory_order_release);
+	}
+}
+
+void TraceLogger::write(uint8_t level, TraceEvent event, const char* subject, double value){
+	TraceRecord record;
+	record.stamp_ns = chrono::duration_cast<chrono::nanoseconds>(
+			chrono::steady_clock::now().time_since_epoch()).count();
+	record.level = level;
+	record.event = event;
+	strncpy(record.subject, subject, KT_TRACE_SUBJECT_LENGTH - 1);
+	record.subject[KT_TRACE_SUBJECT_LENGTH - 1] = '\0';
+	record.value = value;
+
+	//Without the background thread there is nobody to drain the ring
+	if (!running_.load(memory_order_relaxed)){
+		emit(record);
+		return;
+	}
+	if (!ring_lease.ring)
+		ring_lease.ring = acquireRing();
+	ring_lease.ring->push(record);
+}
+
+size_t TraceLogger::drain(){
+	vector<TraceRecord> batch;
+	uint64_t dropped = 0;
+	{
+		lock_guard<mutex> lock(rings_mutex_);
+		for (unique_ptr<TraceRing>& ring : rings_){
+			TraceRecord record;
+			while (ring->pop(record))
+				batch.push_back(record);
+			dropped += ring->dropped.exchange(0, memory_order_relaxed);
+		}
+	}
+
+	//rosconsole may block, new threads get their rings meanwhile
+	if (dropped){
+		uint64_t total_dropped = dropped_records_.fetch_add(dropped, memory_order_relaxed) + dropped;
+		ROS_WARN("Trace ring overflow, %lu records dropped, %lu in total", (unsigned long)dropped,
+		         (unsigned long)total_dropped);
+	}
+	//Rings are drained one after another, restore the global order before printing
+	sort(batch.begin(), batch.end(), [](const TraceRecord& a, const TraceRecord& b){
+		return a.stamp_ns < b.stamp_ns;
+	});
+	for (const TraceRecord& record : batch)
+		emit(record);
+	return batch.size();
+}
+
+uint64_t TraceLogger::getDroppedRecords() const{
+	return dropped_records_.load(memory_order_relaxed);
+}
+
+void TraceLogger::flushLoop(){
+	while (running_.load(memory_order_relaxed)){
+		if (drain() == 0)
+			this_thread::sleep_for(chrono::milliseconds(KT_TRACE_FLUSH_PERIOD_MS));
+	}
+}
+
+}
@@ -0,0 +1,198 @@
+#include <kinematics_test/trajectory_analytics.h>
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include <geometric_shapes/shape_operations.h>
+
+using namespace std;
+using namespace moveit;
+using namespace core;
+
+namespace kinematics_test {
+
+namespace {
+
+//Keeps a segment without tool motion from dividing by zero
+const double MIN_SEGMENT_SECONDS = 1e-9;
+
+/** Translation and orientation of one link at every waypoint, one column per waypoint */
+struct LinkBuffer {
+	Eigen::Matrix3Xd positions;
+	Eigen::Matrix4Xd orientations;
+
+	void resize(size_t waypoint_count){
+		positions.resize(3, waypoint_count);
+		orientations.resize(4, waypoint_count);
+	}
+
+	void set(size_t waypoint_idx, const Eigen::Affine3d& transform){
+		positions.col(waypoint_idx) = transform.translation();
+		orientations.col(waypoint_idx) = Eigen::Quaterniond(transform.rotation()).coeffs();
+	}
+
+	void set(size_t waypoint_idx, const LinkTransformTable& transforms, size_t table_waypoint_idx, size_t link_idx){
+		positions.col(waypoint_idx) = transforms.translation(table_waypoint_idx, link_idx);
+		orientations.col(waypoint_idx) = transforms.orientation(table_waypoint_idx, link_idx);
+	}
+
+	/** Angle between the orientations of neighbouring waypoints, like Quaterniond::angularDistance */
+	Eigen::ArrayXd segmentAngles() const{
+		size_t segments = positions.cols() - 1;
+		Eigen::ArrayXd dots = (orientations.leftCols(segments).array() *
+		                       orientations.rightCols(segments).array()).colwise().sum().transpose();
+		return 2 * dots.abs().min(1.0).acos();
+	}
+
+	Eigen::ArrayXd segmentTranslations() const{
+		size_t segments = positions.cols() - 1;
+		return (positions.rightCols(segments) - positions.leftCols(segments)).colwise().norm().transpose();
+	}
+};
+
+/** Index and value of the first coefficient over its limit, -1 if none. Non-positive limits are unchecked */
+int firstViolation(const Eigen::VectorXd& values, const Eigen::VectorXd& limits){
+	for (int idx = 0; idx < values.size(); ++idx)
+		if (limits[idx] > 0 && values[idx] > limits[idx] + ANALYTICS_TOLERANCE)
+			return idx;
+	return -1;
+}
+
+}
+
+TrajectoryAnalyzer::TrajectoryAnalyzer(const robot_model::RobotModelConstPtr& kinematic_model,
+                                       const string& planning_group, const string& end_effector,
+                                       const vector<const robot_state::LinkModel*>& links,
+                                       const AnalyticsLimits& limits) :
+		jmg_ptr_(kinematic_model->getJointModelGroup(planning_group)),
+		end_effector_(kinematic_model->getLinkModel(end_effector)), links_(links), limits_(limits){
+
+	link_diagonals_.resize(links_.size());
+	for (size_t link_idx = 0; link_idx < links_.size(); ++link_idx)
+		link_diagonals_[link_idx] = shapes::computeShapeExtents(links_[link_idx]->getShapes()[0].get()).norm();
+
+	vector<double> max_velocity, max_acceleration;
+	for (const robot_state::JointModel* joint : jmg_ptr_->getActiveJointModels())
+		for (const robot_state::VariableBounds& bounds : joint->getVariableBounds()){
+			max_velocity.push_back(bounds.velocity_bounded_ ? bounds.max_velocity_ : 0.0);
+			max_acceleration.push_back(bounds.acceleration_bounded_ ? bounds.max_acceleration_ : 0.0);
+		}
+	max_velocity_ = Eigen::Map<Eigen::VectorXd>(max_velocity.data(), max_velocity.size());
+	max_acceleration_ = Eigen::Map<Eigen::VectorXd>(max_acceleration.data(), max_acceleration.size());
+}
+
+const vector<string>& TrajectoryAnalyzer::getJointNames() const{
+	return jmg_ptr_->getVariableNames();
+}
+
+void TrajectoryAnalyzer::analyze(const list<robot_state::RobotStatePtr>& trail, bool straight_path,
+                                 TrajectoryMetrics& metrics) const{
+
+	size_t waypoint_count = trail.size();
+	size_t joint_count = jmg_ptr_->getVariableCount();
+	metrics.waypoint_count = waypoint_count;
+	metrics.duration = 0;
+	metrics.peak_velocity = Eigen::VectorXd::Zero(joint_count);
+	metrics.peak_acceleration = Eigen::VectorXd::Zero(joint_count);
+	metrics.peak_jerk = Eigen::VectorXd::Zero(joint_count);
+	metrics.cartesian_deviation = 0;
+	metrics.link_swept_distance = Eigen::VectorXd::Zero(links_.size());
+	metrics.violation.clear();
+	if (waypoint_count < 2)
+		return;
+
+	//The only pass over the robot states or their transform table, the rest works on the buffers
+	Eigen::MatrixXd joints(joint_count, waypoint_count);
+	LinkBuffer end_effector;
+	vector<LinkBuffer> link_buffers(links_.size());
+	end_effector.resize(waypoint_count);
+	for (LinkBuffer& buffer : link_buffers)
+		buffer.resize(waypoint_count);
+
+	LinkTransformTable* transforms = LinkTransformScope::current();
+	vector<int> table_link_indices;
+	int end_effector_idx = transforms ? transforms->linkIndex(end_effector_) : -1;
+	for (const robot_state::LinkModel* link : links_)
+		table_link_indices.push_back(transforms ? transforms->linkIndex(link) : -1);
+	bool is_cached = end_effector_idx >= 0 &&
+			find(table_link_indices.begin(), table_link_indices.end(), -1) == table_link_indices.end();
+
+	size_t waypoint_idx = 0;
+	for (const robot_state::RobotStatePtr& state : trail){
+		if (is_cached){
+			size_t table_waypoint_idx = transforms->waypoint(state);
+			joints.col(waypoint_idx) = transforms->jointPositions(table_waypoint_idx);
+			end_effector.set(waypoint_idx, *transforms, table_waypoint_idx, end_effector_idx);
+			for (size_t link_idx = 0; link_idx < links_.size(); ++link_idx)
+				link_buffers[link_idx].set(waypoint_idx, *transforms, table_waypoint_idx, table_link_indices[link_idx]);
+		}
+		else {
+			state->copyJointGroupPositions(jmg_ptr_, joints.col(waypoint_idx).data());
+			end_effector.set(waypoint_idx, state->getGlobalLinkTransform(end_effector_));
+			for (size_t link_idx = 0; link_idx < links_.size(); ++link_idx)
+				link_buffers[link_idx].set(waypoint_idx, state->getGlobalLinkTransform(links_[link_idx]));
+		}
+		waypoint_idx++;
+	}
+
+	size_t segments = waypoint_count - 1;
+	Eigen::ArrayXd segment_seconds = (end_effector.segmentTranslations() / limits_.tool_speed)
+			.max(end_effector.segmentAngles() / limits_.tool_angular_speed).max(MIN_SEGMENT_SECONDS);
+	metrics.duration = segment_seconds.sum();
+
+	//Velocities sit in the middle of the segments, accelerations on the inner waypoints
+	Eigen::ArrayXXd velocities = (joints.rightCols(segments) - joints.leftCols(segments)).array().rowwise() /
+			segment_seconds.transpose();
+	metrics.peak_velocity = velocities.abs().rowwise().maxCoeff();
+	if (segments > 1){
+		Eigen::ArrayXd velocity_spans = 0.5 * (segment_seconds.head(segments - 1) + segment_seconds.tail(segments - 1));
+		Eigen::ArrayXXd accelerations = (velocities.rightCols(segments - 1) - velocities.leftCols(segments - 1))
+				.rowwise() / velocity_spans.transpose();
+		metrics.peak_acceleration = accelerations.abs().rowwise().maxCoeff();
+		if (segments > 2){
+			Eigen::ArrayXXd jerks = (accelerations.rightCols(segments - 2) - accelerations.leftCols(segments - 2))
+					.rowwise() / segment_seconds.segment(1, segments - 2).transpose();
+			metrics.peak_jerk = jerks.abs().rowwise().maxCoeff();
+		}
+	}
+
+	Eigen::Vector3d path_start = end_effector.positions.col(0);
+	Eigen::Vector3d path_direction = end_effector.positions.col(segments) - path_start;
+	double path_length = path_direction.norm();
+	Eigen::Matrix3Xd offsets = end_effector.positions.colwise() - path_start;
+	if (path_length > 0){
+		path_direction /= path_length;
+		Eigen::RowVectorXd along = (path_direction.transpose() * offsets).array().max(0.0).min(path_length).matrix();
+		metrics.cartesian_deviation = (offsets - path_direction * along).colwise().norm().maxCoeff();
+	}
+	else
+		metrics.cartesian_deviation = offsets.colwise().norm().maxCoeff();
+
+	//getFullTranslation for every link and segment at once
+	for (size_t link_idx = 0; link_idx < links_.size(); ++link_idx){
+		const LinkBuffer& buffer = link_buffers[link_idx];
+		Eigen::ArrayXd swept = fullTranslationBound<Eigen::ArrayXd>(
+				buffer.segmentTranslations(), buffer.positions.leftCols(segments).colwise().norm().transpose().array(),
+				Eigen::ArrayXd::Constant(segments, link_diagonals_[link_idx]), buffer.segmentAngles());
+		metrics.link_swept_distance[link_idx] = swept.maxCoeff();
+	}
+
+	ostringstream violation;
+	int idx;
+	if ((idx = firstViolation(metrics.peak_velocity, max_velocity_)) >= 0)
+		violation << getJointNames()[idx] << " velocity " << metrics.peak_velocity[idx] << " rad/s";
+	else if ((idx = firstViolation(metrics.peak_acceleration, max_acceleration_)) >= 0)
+		violation << getJointNames()[idx] << " acceleration " << metrics.peak_acceleration[idx] << " rad/s^2";
+	else if ((idx = firstViolation(metrics.peak_jerk,
+	                               Eigen::VectorXd::Constant(joint_count, limits_.max_joint_jerk))) >= 0)
+		violation << getJointNames()[idx] << " jerk " << metrics.peak_jerk[idx] << " rad/s^3";
+	else if (straight_path && limits_.max_cartesian_deviation > 0 &&
+			metrics.cartesian_deviation > limits_.max_cartesian_deviation + ANALYTICS_TOLERANCE)
+		violation << "Cartesian deviation " << metrics.cartesian_deviation << " m";
+	else if ((idx = firstViolation(metrics.link_swept_distance,
+	                               Eigen::VectorXd::Constant(links_.size(), limits_.max_swept_distance))) >= 0)
+		violation << links_[idx]->getName() << " sweeps " << metrics.link_swept_distance[idx] << " m";
+	metrics.violation = violation.str();
+}
+
+}
@@ -0,0 +1,163 @@
+#include <kinematics_test/trajectory_shm_transport.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//Changed with the slot layout, a consumer of another layout refuses the segment
+#define SHM_TRAJECTORY_MAGIC 0x4b545453u
+
+using namespace std;
+
+namespace kinematics_test {
+
+struct ShmRingHeader {
+	uint32_t magic;
+	uint32_t slot_count;
+	uint32_t max_waypoints;
+	uint32_t joint_count;
+	uint64_t slot_stride;
+	//Sequence number of the newest complete trajectory, 0 while empty
+	atomic<uint64_t> published;
+};
+
+struct ShmSlotHeader {
+	//Odd while the producer writes, 2 * trajectory sequence once complete
+	atomic<uint64_t> state;
+	uint64_t waypoint_count;
+};
+
+static size_t alignToCacheLine(size_t size){
+	return (size + 63) / 64 * 64;
+}
+
+TrajectoryShmRing::TrajectoryShmRing(const string& name, size_t slot_count, size_t max_waypoints,
+                                     size_t joint_count) :
+		name_(name), owner_(true), segment_(nullptr), header_(nullptr){
+
+	slot_stride_ = alignToCacheLine(sizeof(ShmSlotHeader) + max_waypoints * (1 + 3 * joint_count) * sizeof(double));
+	segment_size_ = alignToCacheLine(sizeof(ShmRingHeader)) + slot_count * slot_stride_;
+	map(true);
+
+	header_->magic = SHM_TRAJECTORY_MAGIC;
+	header_->slot_count = slot_count;
+	header_->max_waypoints = max_waypoints;
+	header_->joint_count = joint_count;
+	header_->slot_stride = slot_stride_;
+	header_->published.store(0, memory_order_relaxed);
+	for (uint64_t i = 0; i < slot_count; ++i)
+		slot(i)->state.store(0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+TrajectoryShmRing::TrajectoryShmRing(const string& name) :
+		name_(name), segment_size_(0), slot_stride_(0), owner_(false), segment_(nullptr), header_(nullptr){
+	map(false);
+	if (header_->magic != SHM_TRAJECTORY_MAGIC)
+		throw runtime_error("Shared memory segment " + name_ + " is not a trajectory ring");
+	slot_stride_ = header_->slot_stride;
+}
+
+TrajectoryShmRing::~TrajectoryShmRing(){
+	if (segment_)
+		munmap(segment_, segment_size_);
+	if (owner_)
+		shm_unlink(name_.c_str());
+}
+
+void TrajectoryShmRing::map(bool create){
+	int fd = create ? shm_open(name_.c_str(), O_CREAT | O_RDWR, 0600) : shm_open(name_.c_str(), O_RDONLY, 0);
+	if (fd < 0)
+		throw runtime_error("Can't open shared memory segment " + name_);
+
+	if (create && ftruncate(fd, segment_size_) != 0){
+		close(fd);
+		throw runtime_error("Can't resize shared memory segment " + name_);
+	}
+	if (!create){
+		struct stat segment_stat;
+		fstat(fd, &segment_stat);
+		segment_size_ = segment_stat.st_size;
+	}
+
+	//The consumer maps read-only, it never touches the sequence counters
+	segment_ = mmap(nullptr, segment_size_, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (segment_ == MAP_FAILED){
+		segment_ = nullptr;
+		throw runtime_error("Can't map shared memory segment " + name_);
+	}
+	header_ = static_cast<ShmRingHeader*>(segment_);
+}
+
+ShmSlotHeader* TrajectoryShmRing::slot(uint64_t sequence) const{
+	char* slots = static_cast<char*>(segment_) + alignToCacheLine(sizeof(ShmRingHeader));
+	return reinterpret_cast<ShmSlotHeader*>(slots + (sequence % header_->slot_count) * slot_stride_);
+}
+
+size_t TrajectoryShmRing::getJointCount() const{
+	return header_->joint_count;
+}
+
+size_t TrajectoryShmRing::arrayOffset(size_t array_idx) const{
+	return array_idx == 0 ? 0 : header_->max_waypoints * (1 + (array_idx - 1) * header_->joint_count);
+}
+
+bool TrajectoryShmRing::write(const robot_trajectory::RobotTrajectory& trajectory,
+                              const robot_state::JointModelGroup* jmg_ptr){
+	size_t waypoint_count = trajectory.getWayPointCount();
+	if (waypoint_count > header_->max_waypoints || jmg_ptr->getVariableCount() != header_->joint_count)
+		return false;
+
+	uint64_t sequence = header_->published.load(memory_order_relaxed) + 1;
+	ShmSlotHeader* target = slot(sequence);
+	target->state.store(2 * sequence - 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	double* times = reinterpret_cast<double*>(target + 1);
+	double* positions = times + arrayOffset(1);
+	double* velocities = times + arrayOffset(2);
+	double* accelerations = times + arrayOffset(3);
+	for (size_t waypoint_idx = 0; waypoint_idx < waypoint_count; ++waypoint_idx){
+		const robot_state::RobotState& state = trajectory.getWayPoint(waypoint_idx);
+		size_t offset = waypoint_idx * header_->joint_count;
+		times[waypoint_idx] = trajectory.getWayPointDurationFromStart(waypoint_idx);
+		state.copyJointGroupPositions(jmg_ptr, positions + offset);
+		state.copyJointGroupVelocities(jmg_ptr, velocities + offset);
+		state.copyJointGroupAccelerations(jmg_ptr, accelerations + offset);
+	}
+	target->waypoint_count = waypoint_count;
+
+	target->state.store(2 * sequence, memory_order_release);
+	header_->published.store(sequence, memory_order_release);
+	return true;
+}
+
+bool TrajectoryShmRing::latest(View& view) const{
+	uint64_t sequence = header_->published.load(memory_order_acquire);
+	if (sequence == 0)
+		return false;
+
+	const ShmSlotHeader* source = slot(sequence);
+	if (source->state.load(memory_order_acquire) != 2 * sequence)
+		return false;
+
+	view.sequence = sequence;
+	view.waypoint_count = source->waypoint_count;
+	view.joint_count = header_->joint_count;
+	view.times = reinterpret_cast<const double*>(source + 1);
+	view.positions = view.times + arrayOffset(1);
+	view.velocities = view.times + arrayOffset(2);
+	view.accelerations = view.times + arrayOffset(3);
+	return isValid(view);
+}
+
+bool TrajectoryShmRing::isValid(const View& view) const{
+	atomic_thread_fence(memory_order_acquire);
+	return slot(view.sequence)->state.load(memory_order_relaxed) == 2 * view.sequence;
+}
+
+}